@@ -0,0 +1,126 @@
+// Replacement allocator entry points counting the allocations of the
+// whole process (see alloc_counter.h). Built into the host programs with
+// COUNT_ALLOCATIONS only.
+//
+// On glibc, malloc and friends are interposed here and forward to the
+// __libc_* implementations, so allocations from the C++ runtime and
+// shared libraries (XRT) are counted too. Elsewhere only operator new is.
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include "alloc_counter.h"
+
+// constant-initialized, so usable from the allocator before main and
+// during thread start
+static std::atomic<size_t> g_alloc_count(0);
+static thread_local bool t_excluded = false;
+
+size_t alloc_count() { return g_alloc_count.load(std::memory_order_relaxed); }
+
+void alloc_count_exclude_thread() { t_excluded = true; }
+
+static inline void count_alloc() {
+    if (!t_excluded) g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+void* calloc(size_t n, size_t size) {
+    count_alloc();
+    return __libc_calloc(n, size);
+}
+void* realloc(void* p, size_t size) {
+    count_alloc();
+    return __libc_realloc(p, size);
+}
+void* memalign(size_t align, size_t size) {
+    count_alloc();
+    return __libc_memalign(align, size);
+}
+void* aligned_alloc(size_t align, size_t size) {
+    count_alloc();
+    return __libc_memalign(align, size);
+}
+int posix_memalign(void** p, size_t align, size_t size) {
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) return EINVAL;
+    count_alloc();
+    *p = __libc_memalign(align, size);
+    return *p ? 0 : ENOMEM;
+}
+void free(void* p) { __libc_free(p); }
+}
+
+// operator new counts itself; the raw allocators below are not counted again
+static inline void* raw_alloc(size_t size) { return __libc_malloc(size); }
+static inline void* raw_alloc_aligned(size_t size, size_t align) { return __libc_memalign(align, size); }
+static inline void raw_free(void* p) { __libc_free(p); }
+#else
+static inline void* raw_alloc(size_t size) { return malloc(size); }
+static inline void* raw_alloc_aligned(size_t size, size_t align) {
+    void* p = NULL;
+    return posix_memalign(&p, align < sizeof(void*) ? sizeof(void*) : align, size) == 0 ? p : NULL;
+}
+static inline void raw_free(void* p) { free(p); }
+#endif
+
+static void* counted_new(size_t size) {
+    count_alloc();
+    void* p = raw_alloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return counted_new(size); }
+void* operator new[](size_t size) { return counted_new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    count_alloc();
+    return raw_alloc(size ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    count_alloc();
+    return raw_alloc(size ? size : 1);
+}
+void operator delete(void* p) noexcept { raw_free(p); }
+void operator delete[](void* p) noexcept { raw_free(p); }
+void operator delete(void* p, size_t) noexcept { raw_free(p); }
+void operator delete[](void* p, size_t) noexcept { raw_free(p); }
+
+#if __cpp_aligned_new
+static void* counted_new_aligned(size_t size, std::align_val_t align) {
+    count_alloc();
+    void* p = raw_alloc_aligned(size ? size : 1, (size_t) align);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, std::align_val_t align) { return counted_new_aligned(size, align); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_new_aligned(size, align); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    count_alloc();
+    return raw_alloc_aligned(size ? size : 1, (size_t) align);
+}
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    count_alloc();
+    return raw_alloc_aligned(size ? size : 1, (size_t) align);
+}
+void operator delete(void* p, std::align_val_t) noexcept { raw_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { raw_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { raw_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { raw_free(p); }
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+// Allocation counter for the host programs: with COUNT_ALLOCATIONS,
+// alloc_counter.cpp counts every call into the allocator (operator new in
+// all its forms, and on glibc malloc, calloc, realloc and the aligned
+// allocators, whoever calls them), so a steady-state loop can check that
+// it never reaches the allocator, including from threads it hands work
+// to. Without it nothing is counted.
+
+#include <cstddef>
+
+#ifdef COUNT_ALLOCATIONS
+// Allocations so far, by every thread not excluded below
+size_t alloc_count();
+// Leave the calling thread out of alloc_count(): for I/O threads that run
+// alongside a counted section but are not part of it
+void alloc_count_exclude_thread();
+inline bool alloc_counting() { return true; }
+#else
+inline size_t alloc_count() { return 0; }
+inline void alloc_count_exclude_thread() {}
+inline bool alloc_counting() { return false; }
+#endif
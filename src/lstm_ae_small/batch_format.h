@@ -0,0 +1,146 @@
+#pragma once
+
+// File formats of the batch testbenches, picked by file extension:
+//   .npy         NumPy array, little-endian float32 ('<f4') or float16 ('<f2'),
+//                C order, shape (windows, ...) with one window per row
+//   .f32 / .bin  headerless little-endian float32, window after window
+//   .f16         headerless little-endian float16
+//   anything else  text, one "index:v0,v1,..." line per window
+//                ("sensor:index:v0,v1,..." for the results of a window store)
+// The binary formats are read and written in host byte order, which is
+// little-endian on every host we build for (x86, Arm).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+
+enum BatchFormat { FORMAT_TEXT = 0, FORMAT_F32, FORMAT_F16 };
+
+struct BatchFile {
+    BatchFormat format;
+    bool npy;
+};
+
+inline bool path_ends_with(const std::string& path, const char* ext) {
+    size_t n = strlen(ext);
+    return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+}
+
+// Format for a path; for .npy the element type comes from the header
+// (float32 when writing)
+inline BatchFile batch_file_from_path(const std::string& path) {
+    BatchFile f = {FORMAT_TEXT, false};
+    if (path_ends_with(path, ".npy")) { f.format = FORMAT_F32; f.npy = true; }
+    else if (path_ends_with(path, ".f32") || path_ends_with(path, ".bin")) f.format = FORMAT_F32;
+    else if (path_ends_with(path, ".f16")) f.format = FORMAT_F16;
+    return f;
+}
+
+inline size_t batch_elem_size(BatchFormat format) {
+    return format == FORMAT_F16 ? 2 : 4;
+}
+
+// IEEE half <-> float, round to nearest even
+inline float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (man << 13);             // inf, nan
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (man << 13);    // normal
+    } else if (man != 0) {
+        int shift = 0;                                      // subnormal: normalize
+        while (!(man & 0x400)) { man <<= 1; shift++; }
+        bits = sign | ((uint32_t)(113 - shift) << 23) | ((man & 0x3ff) << 13);
+    } else {
+        bits = sign;
+    }
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+inline uint16_t float_to_half(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7fffffff;
+    if (abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);   // inf, nan
+    if (abs >= 0x477ff000) return sign | 0x7c00;                                     // rounds to inf
+    if (abs < 0x38800000) {                                                          // subnormal or zero
+        if (abs < 0x33000000) return sign;
+        uint32_t man = (abs & 0x7fffff) | 0x800000;
+        int shift = 126 - (abs >> 23);
+        uint32_t h = man >> shift;
+        uint32_t rem = man & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | h;
+    }
+    uint32_t h = ((abs - 0x38000000) >> 13);
+    uint32_t rem = abs & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+// Read a .npy header: element type, and the number of values per row
+// (product of the dimensions after the first; 0 for a 1-D array).
+// Leaves the file at the start of the data.
+inline bool npy_read_header(FILE* file, BatchFormat& format, size_t& row_size, std::string& error) {
+    unsigned char pre[10];
+    if (fread(pre, 1, 10, file) != 10 || memcmp(pre, "\x93NUMPY", 6) != 0) { error = "not a .npy file"; return false; }
+    size_t len = pre[8] | (pre[9] << 8);
+    if (pre[6] >= 2) {
+        unsigned char ext[2];
+        if (fread(ext, 1, 2, file) != 2) { error = "truncated .npy header"; return false; }
+        len |= (size_t) ext[0] << 16 | (size_t) ext[1] << 24;
+    }
+    std::string dict(len, '\0');
+    if (fread(&dict[0], 1, len, file) != len) { error = "truncated .npy header"; return false; }
+
+    size_t d = dict.find("'descr'");
+    size_t q = d == std::string::npos ? d : dict.find('\'', d + 7);
+    std::string descr = q == std::string::npos ? "" : dict.substr(q + 1, dict.find('\'', q + 1) - q - 1);
+    if (descr == "<f4") format = FORMAT_F32;
+    else if (descr == "<f2") format = FORMAT_F16;
+    else { error = "unsupported dtype '" + descr + "', expected <f4 or <f2"; return false; }
+
+    if (dict.find("'fortran_order': True") != std::string::npos) { error = "fortran_order arrays are not supported"; return false; }
+
+    size_t s = dict.find("'shape'");
+    size_t open = s == std::string::npos ? s : dict.find('(', s);
+    size_t close = open == std::string::npos ? open : dict.find(')', open);
+    if (close == std::string::npos) { error = "no shape in .npy header"; return false; }
+    row_size = 0;
+    int dims = 0;
+    const char* p = dict.c_str() + open + 1;
+    const char* end = dict.c_str() + close;
+    while (p < end) {
+        char* next;
+        unsigned long v = strtoul(p, &next, 10);
+        if (next == p) { p++; continue; }
+        if (dims++ > 0) row_size = (row_size ? row_size : 1) * v;
+        p = next;
+    }
+    return true;
+}
+
+// Write a .npy v1.0 header of a fixed 128 bytes for shape (rows, row_size),
+// so it can be rewritten in place once the row count is known
+inline bool npy_write_header(FILE* file, BatchFormat format, size_t rows, size_t row_size) {
+    char header[128];
+    memset(header, ' ', sizeof(header));
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (char)(sizeof(header) - 10);
+    header[9] = 0;
+    int n = snprintf(header + 10, sizeof(header) - 10, "{'descr': '%s', 'fortran_order': False, 'shape': (%lu, %lu), }",
+                     format == FORMAT_F16 ? "<f2" : "<f4", (unsigned long) rows, (unsigned long) row_size);
+    if (n < 0 || n >= (int) sizeof(header) - 11) return false;
+    header[10 + n] = ' ';
+    header[sizeof(header) - 1] = '\n';
+    return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+// Batch runner pipeline: input windows go through three stages on their
+// own threads, each working on a different batch,
+//   ingest  WindowReader::read (mapped file, parsed on set_threads cores)
+//           or a WindowStore query
+//   infer   the model, a whole batch per call
+//   output  ResultWriter::write (which also flushes on its own thread)
+// connected by bounded lock-free queues of batch slots. A slot goes back
+// to ingest once its results are written, so memory is fixed at
+// n_slots batches, all allocated before the first window.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "parameters.h"
+#include "nnet_spsc.h"
+#include "alloc_counter.h"
+#include "window_parser.h"
+#include "result_writer.h"
+#include "window_store.h"
+#include "series_windower.h"
+
+struct PipelineStats {
+    size_t windows;
+    double total_ms;
+    double busy_ms[3];      // ingest, infer, output: time not spent waiting on the queues
+    size_t infer_allocs;    // allocations by infer after the first batch (alloc_counter.h)
+
+    static const char* stage_name(int s) {
+        static const char* names[3] = {"ingest", "infer", "output"};
+        return names[s];
+    }
+    // The stage that bounds the throughput
+    int slowest() const {
+        int s = 0;
+        for (int i = 1; i < 3; i++) if (busy_ms[i] > busy_ms[s]) s = i;
+        return s;
+    }
+    void print() const {
+        printf("------------------------------------------------------\n");
+        printf("  Pipeline: %zu windows in %.2f ms (%.0f windows/s)\n", windows, total_ms,
+               total_ms > 0 ? windows * 1000.0 / total_ms : 0.0);
+        for (int s = 0; s < 3; s++) {
+            printf("  %-8s busy %12.2f ms  %5.1f %%%s\n", stage_name(s), busy_ms[s],
+                   total_ms > 0 ? 100.0 * busy_ms[s] / total_ms : 0.0, s == slowest() ? "  <- slowest" : "");
+        }
+        if (alloc_counting()) printf("  infer allocations after warm-up: %zu\n", infer_allocs);
+        printf("------------------------------------------------------\n");
+    }
+};
+
+// Fill batch with up to max_windows windows and their output indices:
+// a WindowReader numbers the windows in file order and has no sensors,
+// other sources (WindowStore) have a read(batch, max_windows, index,
+// sensor) giving the sensor and time of each window
+inline bool source_has_sensors(const WindowReader&) { return false; }
+
+template<class Source>
+bool source_has_sensors(const Source&) { return true; }
+
+inline size_t read_windows(WindowReader& reader, input_t* batch, uint64_t* index, uint32_t*, size_t max_windows, uint64_t first) {
+    size_t n = reader.read(batch, max_windows);
+    for (size_t w = 0; w < n; w++) index[w] = first + w;
+    return n;
+}
+
+template<class Source>
+size_t read_windows(Source& source, input_t* batch, uint64_t* index, uint32_t* sensor, size_t max_windows, uint64_t) {
+    return source.read(batch, max_windows, index, sensor);
+}
+
+// infer(input_t* windows, result_t* results, size_t n) scores n
+// windows of N_TS * N1_LX inputs into n * MODEL_OUT results. It runs on
+// the calling thread, so device handles need not be shared.
+// Progress goes to stdout every progress_s seconds (0: never).
+template<class Source, class Infer>
+PipelineStats run_pipeline(Source& source, ResultWriter& writer, Infer infer,
+                           size_t batch_windows = 4096, double progress_s = 1.0) {
+    typedef std::chrono::steady_clock clock;
+    static const unsigned n_slots = 4;
+    const size_t tensor_size = N_TS * N1_LX;
+
+    struct Slot {
+        std::vector<input_t> in;
+        std::vector<result_t> out;
+        std::vector<uint64_t> index;
+        std::vector<uint32_t> sensor;   // of sources with sensors
+        size_t n;           // 0 marks the end of the input
+    };
+    const bool sensors = source_has_sensors(source);
+    std::vector<Slot> slots(n_slots);
+    nnet::spsc_queue<unsigned, n_slots> free_q, parsed_q, done_q;
+    for (unsigned i = 0; i < n_slots; i++) {
+        slots[i].in.resize(batch_windows * tensor_size);
+        slots[i].out.resize(batch_windows * MODEL_OUT);
+        slots[i].index.resize(batch_windows);
+        if (sensors) slots[i].sensor.resize(batch_windows);
+        free_q.push(i);
+    }
+
+    PipelineStats stats = {0, 0, {0, 0, 0}, 0};
+    const clock::time_point start = clock::now();
+
+    // The I/O stages allocate alongside infer (parser and writer buffers,
+    // zlib), so only infer's allocations are counted
+    std::thread ingest([&] {
+        alloc_count_exclude_thread();
+        uint64_t next = 0;
+        for (;;) {
+            unsigned i;
+            free_q.pop(i);
+            clock::time_point t0 = clock::now();
+            Slot& s = slots[i];
+            s.n = read_windows(source, s.in.data(), s.index.data(), s.sensor.data(), batch_windows, next);
+            next += s.n;
+            stats.busy_ms[0] += std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+            parsed_q.push(i);
+            if (s.n == 0) break;
+        }
+    });
+
+    std::thread output([&] {
+        alloc_count_exclude_thread();
+        clock::time_point last_report = clock::now();
+        for (;;) {
+            unsigned i;
+            done_q.pop(i);
+            Slot& s = slots[i];
+            if (s.n == 0) break;
+            clock::time_point t0 = clock::now();
+            if (sensors) {
+                for (size_t w = 0; w < s.n; w++) writer.write(s.sensor[w], s.index[w], &s.out[w * MODEL_OUT], MODEL_OUT);
+            } else {
+                for (size_t w = 0; w < s.n; w++) writer.write(s.index[w], &s.out[w * MODEL_OUT], MODEL_OUT);
+            }
+            stats.windows += s.n;
+            clock::time_point t1 = clock::now();
+            stats.busy_ms[2] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            free_q.push(i);
+            if (progress_s > 0 && std::chrono::duration<double>(t1 - last_report).count() >= progress_s) {
+                double s_total = std::chrono::duration<double>(t1 - start).count();
+                printf("  %zu windows, %.0f windows/s\n", stats.windows, stats.windows / s_total);
+                fflush(stdout);
+                last_report = t1;
+            }
+        }
+    });
+
+    // The first batch warms up (per-thread executors, device state); after
+    // that the infer stage should not allocate at all
+    bool warm = false;
+    for (;;) {
+        unsigned i;
+        parsed_q.pop(i);
+        Slot& s = slots[i];
+        if (s.n != 0) {
+            clock::time_point t0 = clock::now();
+            const size_t allocs = alloc_count();
+            infer(s.in.data(), s.out.data(), s.n);
+            if (warm) stats.infer_allocs += alloc_count() - allocs;
+            warm = true;
+            stats.busy_ms[1] += std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+        }
+        done_q.push(i);
+        if (s.n == 0) break;
+    }
+
+    ingest.join();
+    output.join();
+    stats.total_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return stats;
+}
+
+// Score the windows of a continuous sample series. samples is a
+// WindowReader opened with tensor_size N1_LX (one sample per line or row);
+// its samples go through windower, and infer(input_t* const* windows,
+// result_t* results, size_t n) gets batches of views into the windower's
+// ring, so overlapping windows are never copied out. Results are indexed
+// by the first sample of their window. The windower capacity should hold
+// batch_windows * stride + N_TS samples for full batches.
+template<class Infer>
+PipelineStats run_series(WindowReader& samples, SeriesWindower& windower, ResultWriter& writer, Infer infer,
+                         size_t batch_windows = 4096) {
+    typedef std::chrono::steady_clock clock;
+    const size_t chunk_samples = 64 << 10;
+    std::vector<input_t> chunk(chunk_samples * N1_LX);
+    std::vector<input_t*> views(batch_windows);
+    std::vector<uint64_t> index(batch_windows);
+    std::vector<result_t> out(batch_windows * MODEL_OUT);
+
+    PipelineStats stats = {0, 0, {0, 0, 0}, 0};
+    const clock::time_point start = clock::now();
+    size_t read = 0, taken = 0;     // samples in chunk, and pushed of them
+    bool eof = false, warm = false;
+    for (;;) {
+        clock::time_point t0 = clock::now();
+        if (taken == read && !eof) {
+            read = samples.read(chunk.data(), chunk_samples);
+            taken = 0;
+            eof = read == 0;
+        }
+        taken += windower.push(&chunk[taken * N1_LX], read - taken);
+        const size_t n = windower.windows(views.data(), index.data(), batch_windows);
+        clock::time_point t1 = clock::now();
+        stats.busy_ms[0] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (n == 0) {
+            if (eof) break;
+            continue;
+        }
+
+        const size_t allocs = alloc_count();
+        infer(views.data(), out.data(), n);
+        if (warm) stats.infer_allocs += alloc_count() - allocs;
+        warm = true;
+        clock::time_point t2 = clock::now();
+        stats.busy_ms[1] += std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+        for (size_t w = 0; w < n; w++) writer.write(index[w], &out[w * MODEL_OUT], MODEL_OUT);
+        windower.release(n);
+        stats.windows += n;
+        stats.busy_ms[2] += std::chrono::duration<double, std::milli>(clock::now() - t2).count();
+    }
+    stats.total_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return stats;
+}
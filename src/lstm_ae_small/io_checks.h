@@ -0,0 +1,363 @@
+#pragma once
+
+// Software checks of the batch runners' I/O: the text parser, the float16
+// conversions, the .npy header, the window store and the series windower,
+// each against a naive reference on generated data. Run by
+// software_lstm_app --check (make check) after the layer checks.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#include "batch_format.h"
+#include "window_parser.h"
+#include "window_store.h"
+#include "series_windower.h"
+#include "layer_checks.h"
+
+namespace io_checks {
+
+using layer_checks::check_rng;
+
+// Uniform in [0, n)
+inline uint32_t pick(check_rng& rng, uint32_t n) {
+    rng.next();
+    return (rng.state >> 8) % n;
+}
+
+inline bool report(const char* name, bool ok, const std::string& what) {
+    if (ok) printf("  %-34s ok\n", name);
+    else printf("  %-34s FAIL: %s\n", name, what.c_str());
+    return ok;
+}
+
+// A file under /tmp for one check, removed with the object
+struct scratch_file {
+    std::string path;
+    explicit scratch_file(const char* ext) {
+        char name[] = "/tmp/lstm_check_XXXXXX";
+        int fd = mkstemp(name);
+        if (fd >= 0) {
+            ::close(fd);
+            unlink(name);
+        }
+        path = std::string(name) + ext;
+    }
+    ~scratch_file() { remove(path.c_str()); }
+    bool write(const std::string& data) const {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f) return false;
+        bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+        return fclose(f) == 0 && ok;
+    }
+};
+
+// WindowReader on generated text against a naive split: lines end in LF
+// or CRLF, blank lines and long runs of trailing spaces are mixed in, some
+// lines miss a value (counted by errors(), the value read as 0), and the
+// last line may have no newline or only its '\r'. Each file is read mapped and buffered
+// (a small buffer, so lines straddle refills), on 1 to 4 threads.
+inline bool check_window_reader() {
+    const char* name = "WindowReader (text)";
+    const size_t T = 3;
+    check_rng rng(45);
+    scratch_file file(".txt");
+    for (int trial = 0; trial < 40; trial++) {
+        std::string text;
+        const int lines = pick(rng, 1500);
+        for (int l = 0; l < lines; l++) {
+            const uint32_t kind = pick(rng, 20);
+            if (kind == 0) {
+                text += pick(rng, 2) ? "\r\n" : "\n";
+                continue;
+            }
+            text += std::to_string(l) + ":";
+            const size_t n_values = kind == 1 ? T - 1 : T;
+            for (size_t i = 0; i < n_values; i++) {
+                char v[32];
+                snprintf(v, sizeof(v), "%s%.2f", i ? "," : "", ((int) pick(rng, 20000) - 10000) / 100.0);
+                text += v;
+            }
+            if (kind == 2) text += std::string(pick(rng, 5000), ' ');
+            if (l < lines - 1 || pick(rng, 2)) text += pick(rng, 3) == 0 ? "\r\n" : "\n";
+        }
+        if (pick(rng, 4) == 0) text += '\r';   // a CRLF cut short at the end
+        if (!file.write(text)) return report(name, false, "unable to write " + file.path);
+
+        // Reference: split at '\n', drop '\r' and blank lines, strtof the
+        // values after the index
+        std::vector<float> ref;
+        size_t ref_errors = 0;
+        for (size_t begin = 0; begin < text.size(); ) {
+            size_t end = text.find('\n', begin);
+            if (end == std::string::npos) end = text.size();
+            std::string line = text.substr(begin, end - begin);
+            begin = end + 1;
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if (line.empty()) continue;
+            const char* p = line.c_str() + line.find(':') + 1;
+            bool ok = true;
+            for (size_t i = 0; i < T; i++) {
+                char* next;
+                float v = strtof(p, &next);
+                if (next == p) { ok = false; v = 0; }
+                ref.push_back(v);
+                p = *next == ',' ? next + 1 : next;
+            }
+            ref_errors += !ok;
+        }
+
+        for (int mapped = 0; mapped < 2; mapped++) {
+            WindowReader reader(T, mapped ? 16 << 20 : 1024, mapped != 0);
+            const unsigned threads = 1 + pick(rng, 4);
+            reader.set_threads(threads);
+            if (!reader.open(file.path)) return report(name, false, "unable to read " + file.path + ": " + reader.error());
+            const size_t max_windows = 1 + pick(rng, 700);
+            std::vector<input_t> batch(max_windows * T);
+            std::vector<float> got;
+            size_t n;
+            while ((n = reader.read(batch.data(), max_windows)) > 0) got.insert(got.end(), batch.begin(), batch.begin() + n * T);
+            if (got != ref || reader.errors() != ref_errors) {
+                char what[160];
+                snprintf(what, sizeof(what), "trial %d (%s, %u threads): %zu windows and %zu errors, expected %zu and %zu",
+                         trial, mapped ? "mapped" : "buffered", threads, got.size() / T, reader.errors(), ref.size() / T, ref_errors);
+                return report(name, false, what);
+            }
+        }
+    }
+    return report(name, true, "");
+}
+
+// half_to_float on every half against the IEEE definition; float_to_half
+// back on every non-NaN half, on the midpoints between neighbours (ties
+// to even) and just either side of them, subnormals and overflow included
+inline bool check_half_float() {
+    const char* name = "float16 conversions";
+    char what[160];
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        const uint32_t exp = (h >> 10) & 0x1f, man = h & 0x3ff;
+        const double mag = exp == 0 ? std::ldexp((double) man, -24) : std::ldexp((double) (man | 0x400), (int) exp - 25);
+        const double ref = (h & 0x8000) ? -mag : mag;
+        const float got = half_to_float((uint16_t) h);
+        bool ok;
+        if (exp == 0x1f) ok = man ? std::isnan(got) : std::isinf(got) && std::signbit(got) == ((h & 0x8000) != 0);
+        else ok = got == (float) ref && std::signbit(got) == ((h & 0x8000) != 0);
+        if (!ok) {
+            snprintf(what, sizeof(what), "half_to_float(0x%04x) = %.9g, expected %.9g", h, got, ref);
+            return report(name, false, what);
+        }
+        if (!(exp == 0x1f && man) && float_to_half(got) != h) {
+            snprintf(what, sizeof(what), "float_to_half(%.9g) = 0x%04x, expected 0x%04x", got, float_to_half(got), h);
+            return report(name, false, what);
+        }
+    }
+    // Positive neighbours a, a + 1 up to 65504 and the tie with infinity
+    // (65520, which rounds to the even infinity); negatives by symmetry
+    for (uint32_t a = 0; a < 0x7c00; a++) {
+        const double lo = half_to_float((uint16_t) a);
+        const double hi = a + 1 < 0x7c00 ? half_to_float((uint16_t) (a + 1)) : 65536.0;
+        const float mid = (float) ((lo + hi) / 2);
+        const uint16_t even = (a & 1) ? (uint16_t) (a + 1) : (uint16_t) a;
+        const float probes[3] = {std::nextafter(mid, 0.0f), mid, std::nextafter(mid, 1e9f)};
+        const uint16_t expect[3] = {(uint16_t) a, even, (uint16_t) (a + 1)};
+        for (int k = 0; k < 3; k++) {
+            for (int sign = 0; sign < 2; sign++) {
+                const float x = sign ? -probes[k] : probes[k];
+                const uint16_t want = expect[k] | (sign ? 0x8000 : 0);
+                if (float_to_half(x) != want) {
+                    snprintf(what, sizeof(what), "float_to_half(%.9g) = 0x%04x, expected 0x%04x", x, float_to_half(x), want);
+                    return report(name, false, what);
+                }
+            }
+        }
+    }
+    return report(name, true, "");
+}
+
+// npy_write_header then npy_read_header for both element types, and a
+// hand-written v2.0 header with a 3-D shape and one with a wrong dtype
+inline bool check_npy_header() {
+    const char* name = "npy header round trip";
+    scratch_file file(".npy");
+    char what[160];
+    const BatchFormat formats[2] = {FORMAT_F32, FORMAT_F16};
+    const size_t shapes[3][2] = {{0, 8}, {12345, 8}, {4000000000ul, 1}};
+    for (int f = 0; f < 2; f++) {
+        for (int s = 0; s < 3; s++) {
+            FILE* out = fopen(file.path.c_str(), "wb");
+            const bool written = out && npy_write_header(out, formats[f], shapes[s][0], shapes[s][1]);
+            if (out) fclose(out);
+            FILE* in = fopen(file.path.c_str(), "rb");
+            BatchFormat format = FORMAT_TEXT;
+            size_t row_size = 0;
+            std::string error;
+            const bool read = in && npy_read_header(in, format, row_size, error);
+            const long data_at = in ? ftell(in) : -1;
+            if (in) fclose(in);
+            if (!written || !read || format != formats[f] || row_size != shapes[s][1] || data_at != 128) {
+                snprintf(what, sizeof(what), "shape (%zu, %zu): read %s, format %d, row size %zu, data at %ld %s",
+                         shapes[s][0], shapes[s][1], read ? "ok" : "failed", (int) format, row_size, data_at, error.c_str());
+                return report(name, false, what);
+            }
+        }
+    }
+
+    const char* dicts[2] = {"{'descr': '<f2', 'fortran_order': False, 'shape': (5, 2, 4), }",
+                            "{'descr': '<f8', 'fortran_order': False, 'shape': (5, 8), }"};
+    for (int k = 0; k < 2; k++) {
+        std::string dict = dicts[k];
+        dict.resize(128 - 12 - 1, ' ');
+        dict += '\n';
+        std::string header("\x93NUMPY\x02\x00", 8);
+        header += (char) dict.size();
+        header += std::string(3, '\0');
+        if (!file.write(header + dict)) return report(name, false, "unable to write " + file.path);
+        FILE* in = fopen(file.path.c_str(), "rb");
+        BatchFormat format = FORMAT_TEXT;
+        size_t row_size = 0;
+        std::string error;
+        const bool read = in && npy_read_header(in, format, row_size, error);
+        if (in) fclose(in);
+        const bool ok = k == 0 ? read && format == FORMAT_F16 && row_size == 8 : !read && !error.empty();
+        if (!ok) {
+            snprintf(what, sizeof(what), "v2.0 header %d: read %s, row size %zu %s", k, read ? "ok" : "failed", row_size, error.c_str());
+            return report(name, false, what);
+        }
+    }
+    return report(name, true, "");
+}
+
+// A store of three sensors with interleaved appends, random time gaps and
+// chunks of 7 windows, raw and deflated, queried by sensor and time range
+// against a filter over the appended windows
+inline bool check_window_store() {
+    const char* name = "WindowStore pack/query";
+    const size_t T = N_TS * N1_LX;
+    const uint32_t sensors[3] = {3, 12, 40};
+    struct window { uint32_t sensor; uint64_t time; std::vector<float> v; };
+    check_rng rng(46);
+    std::vector<window> all;
+    uint64_t next_time[3] = {0, 100, 5};
+    for (int w = 0; w < 200; w++) {
+        const int s = pick(rng, 3);
+        window win = {sensors[s], next_time[s], std::vector<float>(T)};
+        rng.fill(win.v.data(), (int) T);
+        next_time[s] += 1 + pick(rng, 4);
+        all.push_back(win);
+    }
+
+    scratch_file file(".lws");
+    for (int compress = 0; compress < 2; compress++) {
+        WindowStoreWriter writer(7, compress != 0);
+        if (!writer.open(file.path, T)) return report(name, false, "unable to open " + file.path);
+        for (size_t w = 0; w < all.size(); w++) writer.append(all[w].sensor, all[w].time, all[w].v.data());
+        if (!writer.close()) return report(name, false, "unable to write " + file.path);
+
+        WindowStore store;
+        if (!store.open(file.path) || store.tensor_size() != T) return report(name, false, "unable to read " + file.path + ": " + store.error());
+        const char* queries[5][3] = {{"all", NULL, NULL}, {"12", NULL, NULL}, {"3,40", "20", "60"},
+                                     {"all", "150", NULL}, {"7", NULL, NULL}};
+        for (int q = 0; q < 5; q++) {
+            WindowQuery query;
+            query.parse(queries[q][0], queries[q][1], queries[q][2]);
+            store.query(query);
+            std::vector<window> got, ref;
+            std::vector<input_t> batch(16 * T);
+            uint64_t index[16];
+            uint32_t sensor[16];
+            size_t n;
+            while ((n = store.read(batch.data(), 16, index, sensor)) > 0) {
+                for (size_t w = 0; w < n; w++) {
+                    window win = {sensor[w], index[w], std::vector<float>(&batch[w * T], &batch[(w + 1) * T])};
+                    got.push_back(win);
+                }
+            }
+            for (size_t w = 0; w < all.size(); w++) {
+                if (query.has_sensor(all[w].sensor) && all[w].time >= query.t_from && all[w].time <= query.t_to) ref.push_back(all[w]);
+            }
+            // chunks of different sensors may come in any order
+            struct by_sensor_time {
+                bool operator()(const window& a, const window& b) const {
+                    return a.sensor != b.sensor ? a.sensor < b.sensor : a.time < b.time;
+                }
+            };
+            std::stable_sort(got.begin(), got.end(), by_sensor_time());
+            std::sort(ref.begin(), ref.end(), by_sensor_time());
+            bool ok = got.size() == ref.size();
+            for (size_t w = 0; ok && w < got.size(); w++) {
+                ok = got[w].sensor == ref[w].sensor && got[w].time == ref[w].time && got[w].v == ref[w].v;
+            }
+            if (!ok) {
+                char what[160];
+                snprintf(what, sizeof(what), "%s query %d: %zu windows, expected %zu", compress ? "deflated" : "raw", q, got.size(), ref.size());
+                return report(name, false, what);
+            }
+        }
+    }
+    return report(name, true, "");
+}
+
+// SeriesWindower with a ring of a few windows, so it wraps many times,
+// fed in pieces of random size and releasing windows in random batches,
+// against the windows cut from the whole series
+inline bool check_series_windower() {
+    const char* name = "SeriesWindower (wraparound)";
+    const size_t S = N1_LX, W = N_TS * N1_LX, n_samples = 1000;
+    check_rng rng(47);
+    std::vector<input_t> series(n_samples * S);
+    rng.fill(series.data(), (int) series.size());
+    const size_t strides[4] = {1, 3, N_TS, N_TS + 2};
+    for (int k = 0; k < 4; k++) {
+        const size_t stride = strides[k];
+        SeriesWindower windower(stride, N_TS + 5);
+        input_t* views[8];
+        uint64_t first[8];
+        size_t pushed = 0, windows = 0, held = 0;
+        bool ok = true;
+        while (ok && (pushed < n_samples || held > 0)) {
+            if (pushed < n_samples) {
+                const size_t n = std::min<size_t>(1 + pick(rng, 9), n_samples - pushed);
+                pushed += windower.push(&series[pushed * S], n);
+            }
+            const size_t got = windower.windows(views + held, first + held, 8 - held);
+            for (size_t w = held; ok && w < held + got; w++) {
+                const uint64_t expect = (uint64_t) (windows + w - held) * stride;
+                ok = first[w] == expect && std::equal(views[w], views[w] + W, &series[expect * S]);
+            }
+            windows += got;
+            held += got;
+            const size_t done = held == 0 ? 0 : 1 + pick(rng, (uint32_t) held);
+            windower.release(done);
+            for (size_t w = done; w < held; w++) {
+                views[w - done] = views[w];
+                first[w - done] = first[w];
+            }
+            held -= done;
+            if (pushed == n_samples && got == 0 && held == 0) break;
+        }
+        const size_t expect_windows = (n_samples - N_TS) / stride + 1;
+        if (!ok || windows != expect_windows) {
+            char what[160];
+            snprintf(what, sizeof(what), "stride %zu: %zu windows, expected %zu%s", stride, windows, expect_windows, ok ? "" : ", window mismatch");
+            return report(name, false, what);
+        }
+    }
+    return report(name, true, "");
+}
+
+inline bool run_all() {
+    bool ok = true;
+    ok &= check_window_reader();
+    ok &= check_half_float();
+    ok &= check_npy_header();
+    ok &= check_window_store();
+    ok &= check_series_windower();
+    return ok;
+}
+
+} // namespace io_checks
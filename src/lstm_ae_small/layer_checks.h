@@ -0,0 +1,426 @@
+#pragma once
+
+// Software checks of the nnet_utils kernels the shipped model does not run,
+// each against a plain reference on fixed pseudo-random weights. Run by
+// software_lstm_app --check (make check); a kernel that stops matching its
+// reference fails the run.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "parameters.h"
+#include "../nnet_utils/nnet_gru.h"
+
+namespace layer_checks {
+
+// Fixed LCG, so every run checks the same weights
+struct check_rng {
+    uint32_t state;
+    explicit check_rng(uint32_t seed) : state(seed) {}
+    // uniform in [-1, 1)
+    float next() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    }
+    void fill(float* x, int n) { for (int i = 0; i < n; i++) x[i] = next(); }
+};
+
+// Compare n values against the reference, report the first mismatch
+inline bool check_close(const char* name, const float* got, const float* ref, int n, float tol = 1e-5f) {
+    for (int i = 0; i < n; i++) {
+        if (!(std::fabs(got[i] - ref[i]) <= tol * (1.0f + std::fabs(ref[i])))) {
+            printf("  %-34s FAIL at %d: %.9g, expected %.9g\n", name, i, got[i], ref[i]);
+            return false;
+        }
+    }
+    printf("  %-34s ok\n", name);
+    return true;
+}
+
+// Shape of the recurrent projections (config_h): N1_LH in, 4*N1_LH out
+struct check_dense_config : nnet::dense_config {
+    static const unsigned n_in = N1_LH;
+    static const unsigned n_out = N1_LH * 4;
+};
+
+// dense_sparse against dense_simple on a magnitude-pruned matrix: the
+// smaller half of the weights is zeroed and the rest stored as
+// compressed_weight triples, row-major as load_compressed_weights_from_txt
+// reads them
+struct check_sparse_config : check_dense_config {
+    static const unsigned n_zeros = n_in * n_out / 2;
+};
+
+inline bool check_dense_sparse() {
+    typedef check_sparse_config cfg;
+    const int n_w = cfg::n_in * cfg::n_out;
+    check_rng rng(29);
+    std::vector<float> w(n_w), b(cfg::n_out), x(cfg::n_in);
+    rng.fill(w.data(), n_w);
+    rng.fill(b.data(), cfg::n_out);
+    rng.fill(x.data(), cfg::n_in);
+
+    std::vector<int> order(n_w);
+    for (int i = 0; i < n_w; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int c) { return std::fabs(w[a]) < std::fabs(w[c]); });
+    for (unsigned i = 0; i < cfg::n_zeros; i++) w[order[i]] = 0;
+
+    std::vector<nnet::compressed_weight<float> > cw;
+    for (int i = 0; i < n_w; i++) {
+        if (w[i] == 0) continue;
+        nnet::compressed_weight<float> c = {(unsigned short) (i / cfg::n_out), (unsigned short) (i % cfg::n_out), w[i]};
+        cw.push_back(c);
+    }
+
+    float ref[cfg::n_out], got[cfg::n_out], got_dispatch[cfg::n_out];
+    nnet::dense_simple<float, float, cfg>(x.data(), ref, w.data(), b.data());
+    nnet::dense_sparse<float, float, cfg>(x.data(), got, cw.data(), b.data());
+    nnet::dense<float, float, cfg>(x.data(), got_dispatch, cw.data(), b.data());
+    bool ok = check_close("dense_sparse", got, ref, cfg::n_out);
+    ok &= check_close("dense (compressed_weight)", got_dispatch, ref, cfg::n_out);
+    return ok;
+}
+
+// dense_pow2 against dense_simple on the same weights as floats: each
+// weight is (-1)^sign * 2^e with e in [-4, 1], as exponent_weight pairs
+inline bool check_dense_pow2() {
+    typedef check_dense_config cfg;
+    const int n_w = cfg::n_in * cfg::n_out;
+    check_rng rng(30);
+    std::vector<float> w(n_w), b(cfg::n_out), x(cfg::n_in);
+    std::vector<nnet::exponent_weight<cfg::exponent_t> > ew(n_w);
+    for (int i = 0; i < n_w; i++) {
+        const float r = rng.next();
+        const int e = (int) ((r + 1.0f) * 3.0f) - 4;
+        ew[i].sign = r < 0;
+        ew[i].weight = e;
+        w[i] = (r < 0 ? -1.0f : 1.0f) * std::ldexp(1.0f, e);
+    }
+    rng.fill(b.data(), cfg::n_out);
+    rng.fill(x.data(), cfg::n_in);
+
+    float ref[cfg::n_out], got[cfg::n_out], got_dispatch[cfg::n_out];
+    nnet::dense_simple<float, float, cfg>(x.data(), ref, w.data(), b.data());
+    nnet::dense_pow2<float, float, cfg>(x.data(), got, ew.data(), b.data());
+    nnet::dense<float, float, cfg>(x.data(), got_dispatch, ew.data(), b.data());
+    bool ok = check_close("dense_pow2", got, ref, cfg::n_out);
+    ok &= check_close("dense (exponent_weight)", got_dispatch, ref, cfg::n_out);
+    return ok;
+}
+
+// LSTM layer configs of the checks: 3 inputs, N1_LH hidden, N_TS steps.
+// CPU_FUSED_MAX_H 0 keeps every step on lstm_step's unfused path.
+template<unsigned LH, unsigned GATES>
+struct check_proj_config : nnet::dense_config {
+    static const unsigned n_out = LH * GATES;
+};
+
+template<unsigned CPU_FUSED_MAX_H>
+struct check_lstm_config : nnet::lstm_config {
+    static const unsigned length_x = 3;
+    static const unsigned length_h = N1_LH;
+    static const unsigned timestep = N_TS;
+    static const unsigned reuse_factor_ts = N_TS;
+    static const unsigned cpu_fused_max_h = CPU_FUSED_MAX_H;
+};
+
+template<unsigned IMPL>
+struct check_activ_config : nnet::activ_config {
+    static const unsigned n_in = N1_LH;
+    static const unsigned activ_impl = IMPL;
+    typedef float table_t;
+};
+
+// nnet::sigmoid/tanh of one implementation against the exact functions on
+// a 0.0005 grid over [-10, 10], table range and saturated tails included;
+// the bounds sit ~10% above each implementation's measured max error
+template<unsigned IMPL>
+inline bool check_activation(const char* name, double sigmoid_bound, double tanh_bound) {
+    typedef check_activ_config<IMPL> cfg;
+    double sigmoid_err = 0, tanh_err = 0;
+    float sigmoid_at = 0, tanh_at = 0;
+    for (int k = -20000; k <= 20000; k += cfg::n_in) {
+        float x[cfg::n_in], sig[cfg::n_in], th[cfg::n_in];
+        for (int i = 0; i < (int) cfg::n_in; i++) x[i] = (k + i) * 0.0005f;
+        nnet::sigmoid<float, float, cfg>(x, sig);
+        nnet::tanh<float, float, cfg>(x, th);
+        for (int i = 0; i < (int) cfg::n_in; i++) {
+            double e = std::fabs(sig[i] - 1.0 / (1.0 + std::exp(-(double) x[i])));
+            if (e > sigmoid_err) { sigmoid_err = e; sigmoid_at = x[i]; }
+            e = std::fabs(th[i] - std::tanh((double) x[i]));
+            if (e > tanh_err) { tanh_err = e; tanh_at = x[i]; }
+        }
+    }
+    if (sigmoid_err > sigmoid_bound || tanh_err > tanh_bound) {
+        printf("  %-34s FAIL: max error sigmoid %.3g at %g (bound %.3g), tanh %.3g at %g (bound %.3g)\n",
+               name, sigmoid_err, sigmoid_at, sigmoid_bound, tanh_err, tanh_at, tanh_bound);
+        return false;
+    }
+    printf("  %-34s ok\n", name);
+    return true;
+}
+
+struct check_lstm_x_config : check_proj_config<N1_LH, 4> { static const unsigned n_in = 3; };
+struct check_lstm_h_config : check_proj_config<N1_LH, 4> {
+    static const unsigned n_in = N1_LH;
+    static const unsigned accum_type = ACCUM_H;
+};
+
+// The fused software cell (lstm_cell_fused) against lstm_step's unfused
+// path, over a sequence, for one sigmoid/tanh implementation
+template<unsigned IMPL>
+inline bool check_lstm_fused(const char* name) {
+    typedef check_lstm_config<N1_LH> fused_t;
+    typedef check_lstm_config<0> unfused_t;
+    typedef check_activ_config<IMPL> activ_t;
+    const int NX = fused_t::length_x, NH = fused_t::length_h, NT = fused_t::timestep;
+    check_rng rng(34);
+    std::vector<float> wx(NX * NH * 4), wh(NH * NH * 4), b(NH * 4), x(NX * NT);
+    rng.fill(wx.data(), wx.size());
+    rng.fill(wh.data(), wh.size());
+    rng.fill(b.data(), b.size());
+    rng.fill(x.data(), x.size());
+
+    float ref[NH * NT], got[NH * NT];
+    nnet::lstm_seq<float, float, unfused_t, activ_t, check_lstm_x_config, check_lstm_h_config>(x.data(), wx.data(), wh.data(), b.data(), ref);
+    nnet::lstm_seq<float, float, fused_t, activ_t, check_lstm_x_config, check_lstm_h_config>(x.data(), wx.data(), wh.data(), b.data(), got);
+    return check_close(name, got, ref, NH * NT, 0);
+}
+
+// Two-layer stack of the check LSTM: 3 inputs, then N1_LH. Sequential
+// unless WAVEFRONT (software wavefront, lstm_stack_wavefront).
+struct check_lstm_deep_config : check_lstm_config<N1_LH> { static const unsigned length_x = N1_LH; };
+struct check_lstm_x_deep_config : check_proj_config<N1_LH, 4> { static const unsigned n_in = N1_LH; };
+
+template<int L>
+struct check_stack_layer {
+    typedef check_lstm_deep_config             config;
+    typedef check_activ_config<ACTIV_IMPL>     activ_config;
+    typedef check_lstm_x_deep_config           config_x;
+    typedef check_lstm_h_config                config_h;
+};
+
+template<>
+struct check_stack_layer<0> {
+    typedef check_lstm_config<N1_LH>           config;
+    typedef check_activ_config<ACTIV_IMPL>     activ_config;
+    typedef check_lstm_x_config                config_x;
+    typedef check_lstm_h_config                config_h;
+};
+
+template<bool RETURN_SEQUENCES, bool WAVEFRONT>
+struct check_stack_config : nnet::lstm_stack_config {
+    static const bool return_sequences = RETURN_SEQUENCES;
+    static const bool cpu_wavefront = WAVEFRONT;
+    template<int L>
+    struct layer : check_stack_layer<L> {};
+};
+
+// Fixed inputs and packed weights of the two-layer check stack
+struct check_stack_data {
+    static const int NX = 3, NH = N1_LH, NT = N_TS;
+    std::vector<float> wx, wh, b, x;
+    check_stack_data() : wx((NX + NH) * NH * 4), wh(2 * NH * NH * 4), b(2 * NH * 4), x(NX * NT) {
+        check_rng rng(38);
+        rng.fill(wx.data(), wx.size());
+        rng.fill(wh.data(), wh.size());
+        rng.fill(b.data(), b.size());
+        rng.fill(x.data(), x.size());
+    }
+    // The layers chained by hand: lstm_seq, then lstm_seq or lstm
+    void reference(bool return_sequences, float* res) {
+        typedef check_stack_layer<0> l0;
+        typedef check_stack_layer<1> l1;
+        float seq[NH * NT];
+        nnet::lstm_seq<float, float, l0::config, l0::activ_config, l0::config_x, l0::config_h>(x.data(), wx.data(), wh.data(), b.data(), seq);
+        if (return_sequences)
+            nnet::lstm_seq<float, float, l1::config, l1::activ_config, l1::config_x, l1::config_h>(seq, &wx[NX * NH * 4], &wh[NH * NH * 4], &b[NH * 4], res);
+        else
+            nnet::lstm<float, float, l1::config, l1::activ_config, l1::config_x, l1::config_h>(seq, &wx[NX * NH * 4], &wh[NH * NH * 4], &b[NH * 4], res);
+    }
+};
+
+// lstm_stack, array and stream forms, against the layers chained by hand
+template<bool RETURN_SEQUENCES>
+inline bool check_lstm_stack(const char* name_array, const char* name_stream) {
+    typedef check_stack_config<RETURN_SEQUENCES, false> stack_t;
+    check_stack_data d;
+    const int n_out = d.NH * (RETURN_SEQUENCES ? d.NT : 1);
+    float ref[check_stack_data::NH * check_stack_data::NT], got[check_stack_data::NH * check_stack_data::NT];
+    d.reference(RETURN_SEQUENCES, ref);
+
+    nnet::lstm_stack<float, float, 2, stack_t>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got);
+    bool ok = check_close(name_array, got, ref, n_out, 0);
+
+    hls::stream<float> in_s, out_s;
+    for (size_t i = 0; i < d.x.size(); i++) in_s.write(d.x[i]);
+    nnet::lstm_stack<float, float, 2, stack_t>(in_s, d.wx.data(), d.wh.data(), d.b.data(), out_s);
+    for (int i = 0; i < n_out; i++) got[i] = out_s.read();
+    ok &= check_close(name_stream, got, ref, n_out, 0);
+    return ok;
+}
+
+// The software wavefront against the sequential lstm_stack: the executor
+// itself, whatever the core count, twice to cover the reuse of its
+// workers; then lstm_stack with cpu_wavefront from two threads at once,
+// which share the one executor (or run the layers themselves)
+template<bool RETURN_SEQUENCES>
+inline bool check_lstm_wavefront(const char* suffix) {
+    typedef check_stack_config<RETURN_SEQUENCES, false> sequential_t;
+    typedef check_stack_config<RETURN_SEQUENCES, true> wavefront_t;
+    const int n = check_stack_data::NH * check_stack_data::NT;
+    const int n_out = check_stack_data::NH * (RETURN_SEQUENCES ? check_stack_data::NT : 1);
+    check_stack_data d;
+    float ref[n], got[4][n];
+    nnet::lstm_stack<float, float, 2, sequential_t>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), ref);
+    {
+        nnet::lstm_stack_wavefront<float, float, 2, wavefront_t> exec;
+        exec.run(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got[0]);
+        exec.run(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got[1]);
+    }
+    std::thread other([&] { nnet::lstm_stack<float, float, 2, wavefront_t>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got[3]); });
+    nnet::lstm_stack<float, float, 2, wavefront_t>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got[2]);
+    other.join();
+
+    const char* names[4] = {"lstm_stack_wavefront", "lstm_stack_wavefront rerun", "lstm_stack wavefront", "lstm_stack wavefront 2nd"};
+    bool ok = true;
+    for (int i = 0; i < 4; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s%s", names[i], suffix);
+        ok &= check_close(name, got[i], ref, n_out, 0);
+    }
+    return ok;
+}
+
+// GRU layers of the check: 3 inputs, N1_LH hidden, N_TS steps, 3 gates;
+// TimeDistributed dense to 2 outputs for gru_seq_td
+template<unsigned CPU_FUSED_MAX_H>
+struct check_gru_config : nnet::gru_config {
+    static const unsigned length_x = 3;
+    static const unsigned length_h = N1_LH;
+    static const unsigned timestep = N_TS;
+    static const unsigned reuse_factor_ts = N_TS;
+    static const unsigned cpu_fused_max_h = CPU_FUSED_MAX_H;
+};
+
+struct check_gru_x_config : check_proj_config<N1_LH, 3> { static const unsigned n_in = 3; };
+struct check_gru_h_config : check_proj_config<N1_LH, 3> { static const unsigned n_in = N1_LH; };
+struct check_gru_td_config : nnet::dense_config {
+    static const unsigned n_in = N1_LH;
+    static const unsigned n_out = 2;
+};
+
+// Fixed inputs and weights of the check GRU, and torch.nn.GRU in double
+// precision as the reference: seq[t*NH ..] is h after step t, td[t*NTD ..]
+// the dense of it
+struct check_gru_data {
+    static const int NX = 3, NH = N1_LH, NT = N_TS, NTD = check_gru_td_config::n_out;
+    std::vector<float> wx, wh, b, wtd, btd, x;
+    double seq[NH * NT], td[NTD * NT];
+    check_gru_data() : wx(NX * NH * 3), wh(NH * NH * 3), b(NH * 6), wtd(NH * NTD), btd(NTD), x(NX * NT) {
+        check_rng rng(40);
+        rng.fill(wx.data(), wx.size());
+        rng.fill(wh.data(), wh.size());
+        rng.fill(b.data(), b.size());
+        rng.fill(wtd.data(), wtd.size());
+        rng.fill(btd.data(), btd.size());
+        rng.fill(x.data(), x.size());
+
+        double h[NH] = {0};
+        for (int t = 0; t < NT; t++) {
+            double gx[NH * 3], gh[NH * 3];
+            for (int j = 0; j < NH * 3; j++) {
+                gx[j] = b[j];
+                gh[j] = b[NH * 3 + j];
+                for (int i = 0; i < NX; i++) gx[j] += (double) x[t * NX + i] * wx[i * NH * 3 + j];
+                for (int i = 0; i < NH; i++) gh[j] += h[i] * wh[i * NH * 3 + j];
+            }
+            for (int j = 0; j < NH; j++) {
+                const double r = 1.0 / (1.0 + std::exp(-(gx[j] + gh[j])));
+                const double z = 1.0 / (1.0 + std::exp(-(gx[NH + j] + gh[NH + j])));
+                const double n = std::tanh(gx[2 * NH + j] + r * gh[2 * NH + j]);
+                h[j] = (1.0 - z) * n + z * h[j];
+            }
+            for (int j = 0; j < NH; j++) seq[t * NH + j] = h[j];
+            for (int k = 0; k < NTD; k++) {
+                td[t * NTD + k] = btd[k];
+                for (int j = 0; j < NH; j++) td[t * NTD + k] += h[j] * wtd[j * NTD + k];
+            }
+        }
+    }
+};
+
+inline bool check_close(const char* name, const float* got, const double* ref, int n) {
+    std::vector<float> ref_f(ref, ref + n);
+    return check_close(name, got, ref_f.data(), n);
+}
+
+// gru_seq, gru and gru_seq_td, array and stream forms, against the
+// reference; gru_seq also on gru_step's unfused path
+inline bool check_gru() {
+    typedef check_gru_config<N1_LH> cfg;
+    typedef check_gru_config<0> unfused_t;
+    typedef check_activ_config<nnet::activ_exact> activ_t;
+    typedef check_gru_x_config cx;
+    typedef check_gru_h_config ch;
+    typedef check_gru_td_config ctd;
+    check_gru_data d;
+    const int NH = d.NH, NT = d.NT, NTD = d.NTD;
+    float got[check_gru_data::NH * check_gru_data::NT];
+    bool ok = true;
+
+    nnet::gru_seq<float, float, cfg, activ_t, cx, ch>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got);
+    ok &= check_close("gru_seq (array)", got, d.seq, NH * NT);
+    nnet::gru_seq<float, float, unfused_t, activ_t, cx, ch>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got);
+    ok &= check_close("gru_seq (array, unfused)", got, d.seq, NH * NT);
+    nnet::gru<float, float, cfg, activ_t, cx, ch>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), got);
+    ok &= check_close("gru (array)", got, &d.seq[(NT - 1) * NH], NH);
+    nnet::gru_seq_td<float, float, cfg, activ_t, cx, ch, ctd>(d.x.data(), d.wx.data(), d.wh.data(), d.b.data(), d.wtd.data(), d.btd.data(), got);
+    ok &= check_close("gru_seq_td (array)", got, d.td, NTD * NT);
+
+    hls::stream<float> in_s, out_s;
+    for (size_t i = 0; i < d.x.size(); i++) in_s.write(d.x[i]);
+    nnet::gru_seq<float, float, cfg, activ_t, cx, ch>(in_s, d.wx.data(), d.wh.data(), d.b.data(), out_s);
+    for (int i = 0; i < NH * NT; i++) got[i] = out_s.read();
+    ok &= check_close("gru_seq (stream)", got, d.seq, NH * NT);
+
+    for (size_t i = 0; i < d.x.size(); i++) in_s.write(d.x[i]);
+    nnet::gru<float, float, cfg, activ_t, cx, ch>(in_s, d.wx.data(), d.wh.data(), d.b.data(), out_s);
+    for (int i = 0; i < NH; i++) got[i] = out_s.read();
+    ok &= check_close("gru (stream)", got, &d.seq[(NT - 1) * NH], NH);
+
+    for (size_t i = 0; i < d.x.size(); i++) in_s.write(d.x[i]);
+    nnet::gru_seq_td<float, float, cfg, activ_t, cx, ch, ctd>(in_s, d.wx.data(), d.wh.data(), d.b.data(), d.wtd.data(), d.btd.data(), out_s);
+    for (int i = 0; i < NTD * NT; i++) got[i] = out_s.read();
+    ok &= check_close("gru_seq_td (stream)", got, d.td, NTD * NT);
+    return ok;
+}
+
+// Run every check; true if all pass
+inline bool run_all() {
+    bool ok = true;
+    ok &= check_dense_sparse();
+    ok &= check_dense_pow2();
+    ok &= check_activation<nnet::activ_lut>("sigmoid/tanh (lut)", 4.3e-3, 8.6e-3);
+    ok &= check_activation<nnet::activ_lut_direct>("sigmoid/tanh (lut_direct)", 4.3e-3, 8.6e-3);
+    ok &= check_activation<nnet::activ_lut_interp>("sigmoid/tanh (lut_interp)", 8.5e-4, 1.7e-3);
+    ok &= check_activation<nnet::activ_pwl>("sigmoid/tanh (pwl)", 0.021, 0.042);
+    ok &= check_activation<nnet::activ_poly>("sigmoid/tanh (poly)", 0.024, 0.048);
+    ok &= check_activation<nnet::activ_lut_shared>("sigmoid/tanh (lut_shared)", 4.3e-3, 8.6e-3);
+    ok &= check_activation<nnet::activ_exact>("sigmoid/tanh (exact)", 1e-6, 1e-6);
+    ok &= check_lstm_fused<nnet::activ_lut>("lstm_cell_fused (lut)");
+    ok &= check_lstm_fused<nnet::activ_lut_shared>("lstm_cell_fused (lut_shared)");
+    ok &= check_lstm_fused<nnet::activ_exact>("lstm_cell_fused (exact)");
+    ok &= check_lstm_stack<true>("lstm_stack (array)", "lstm_stack (stream)");
+    ok &= check_lstm_stack<false>("lstm_stack (array, last)", "lstm_stack (stream, last)");
+    ok &= check_lstm_wavefront<true>("");
+    ok &= check_lstm_wavefront<false>(" (last)");
+    ok &= check_gru();
+    return ok;
+}
+
+} // namespace layer_checks
@@ -4,6 +4,22 @@
 
 #include "math.h"
 #include "lstm.h"
+#if USE_GRU
+// No GRU model has been exported yet: stop here rather than on the first
+// missing include, until HLS_AE_SMALL_GRU/ exists
+#if defined(__has_include)
+#if !__has_include("HLS_AE_SMALL_GRU/lstm1_wx.h")
+#error "USE_GRU needs the GRU weights exported to HLS_AE_SMALL_GRU/ (lstm1_wx.h .. lstm2_wb.h, RNN_GATES gates and RNN_BIASES biases per unit)"
+#endif
+#endif
+#include "HLS_AE_SMALL_GRU/lstm1_wx.h"
+#include "HLS_AE_SMALL_GRU/lstm1_wh.h"
+#include "HLS_AE_SMALL_GRU/lstm1_wb.h"
+
+#include "HLS_AE_SMALL_GRU/lstm2_wx.h"
+#include "HLS_AE_SMALL_GRU/lstm2_wh.h"
+#include "HLS_AE_SMALL_GRU/lstm2_wb.h"
+#else
 #include "HLS_AE_SMALL/lstm1_wx.h"
 #include "HLS_AE_SMALL/lstm1_wh.h"
 #include "HLS_AE_SMALL/lstm1_wb.h"
@@ -11,10 +27,23 @@
 #include "HLS_AE_SMALL/lstm2_wx.h"
 #include "HLS_AE_SMALL/lstm2_wh.h"
 #include "HLS_AE_SMALL/lstm2_wb.h"
+#endif
 
 #include "HLS_AE_SMALL/dense1_w.h"
 #include "HLS_AE_SMALL/dense1_b.h"
 
+// The exported weights must hold every stacked layer (N1_LAYERS, N2_LAYERS):
+// the stacks and ae_load_weights index them by the N*_W*_SIZE layout
+#define AE_ASSERT_SIZE(w, n) static_assert(sizeof(w) / sizeof(w[0]) == (n), #w " does not match the layer configuration in parameters.h")
+AE_ASSERT_SIZE(lstm1_wx, N1_WX_SIZE);
+AE_ASSERT_SIZE(lstm1_wh, N1_WH_SIZE);
+AE_ASSERT_SIZE(lstm1_wb, N1_WB_SIZE);
+AE_ASSERT_SIZE(lstm2_wx, N2_WX_SIZE);
+AE_ASSERT_SIZE(lstm2_wh, N2_WH_SIZE);
+AE_ASSERT_SIZE(lstm2_wb, N2_WB_SIZE);
+AE_ASSERT_SIZE(dense1_w, DENSE1_IN * DENSE1_OUT);
+AE_ASSERT_SIZE(dense1_b, DENSE1_OUT);
+
 
 // workaround the csynth latency issue via putting the for-loop in a function
 void ae_repeat(
@@ -29,8 +58,40 @@ void ae_repeat(
 	}
 };
 
-#pragma hls_design top
-void lstm(
+#if RUNTIME_WEIGHTS
+template<class src_T, class dst_T, int N>
+void copy_weights(src_T src[N], dst_T dst[N]){
+	for(int ii = 0; ii < N; ii++){
+		#pragma HLS PIPELINE II=1
+		dst[ii] = (dst_T) src[ii];
+	}
+}
+
+// Copy the packed weight buffer (see the *_OFFSET layout in parameters.h)
+// into the resident weight RAMs. They keep their contents across calls.
+// The storage is bound here, under the preprocessor switch, since HLS
+// applies a pragma whatever C++ if surrounds it; dense_simple banks them.
+void ae_load_weights(
+    model_default_t weights_in[N_WEIGHTS]
+){
+	#pragma HLS BIND_STORAGE variable=lstm1_wx type=ram_2p impl=bram
+	#pragma HLS BIND_STORAGE variable=lstm1_wh type=ram_2p impl=bram
+	#pragma HLS BIND_STORAGE variable=lstm2_wx type=ram_2p impl=bram
+	#pragma HLS BIND_STORAGE variable=lstm2_wh type=ram_2p impl=bram
+	#pragma HLS BIND_STORAGE variable=dense1_w type=ram_2p impl=bram
+
+	copy_weights<model_default_t, model_default_t, N1_WX_SIZE>(&weights_in[LSTM1_WX_OFFSET], lstm1_wx);
+	copy_weights<model_default_t, model_default_t, N1_WH_SIZE>(&weights_in[LSTM1_WH_OFFSET], lstm1_wh);
+	copy_weights<model_default_t, accum_lstm_t,    N1_WB_SIZE>(&weights_in[LSTM1_WB_OFFSET], lstm1_wb);
+	copy_weights<model_default_t, model_default_t, N2_WX_SIZE>(&weights_in[LSTM2_WX_OFFSET], lstm2_wx);
+	copy_weights<model_default_t, model_default_t, N2_WH_SIZE>(&weights_in[LSTM2_WH_OFFSET], lstm2_wh);
+	copy_weights<model_default_t, accum_lstm_t,    N2_WB_SIZE>(&weights_in[LSTM2_WB_OFFSET], lstm2_wb);
+	copy_weights<model_default_t, model_default_t, DENSE1_IN*DENSE1_OUT>(&weights_in[DENSE1_W_OFFSET], dense1_w);
+	copy_weights<model_default_t, accum_lstm_t,    DENSE1_OUT>   (&weights_in[DENSE1_B_OFFSET], dense1_b);
+};
+#endif
+
+void ae_infer(
 		input_t lstm_in[N_TS*N1_LX],
 		result_t lstm_out[MODEL_OUT]
 ){
@@ -39,6 +100,9 @@ void lstm(
 
 	result_t lstm1_out [N1_LH];
     result_t repeat_out [N1_LH*N_TS];
+#if TD_DEFERRED
+    result_t lstm2_out [N2_LH*N_TS];
+#endif
 
 
 	#pragma HLS DATAFLOW
@@ -50,14 +114,24 @@ void lstm(
     //#pragma HLS ARRAY_PARTITION variable=lstm_in cyclic factor=input_factor
     #pragma HLS ARRAY_PARTITION variable=lstm1_out complete
 	#pragma HLS ARRAY_PARTITION variable=repeat_out cyclic factor=layer1_lh
+#if TD_DEFERRED
+	enum { layer2_lh = N2_LH };
+	#pragma HLS ARRAY_PARTITION variable=lstm2_out cyclic factor=layer2_lh
+#endif
 
     // LSTM with seq=false
+#if USE_GRU
+	nnet::gru<input_t, result_t, config1, config2, config_x, config_h>(lstm_in, lstm1_wx, lstm1_wh, lstm1_wb, lstm1_out);
+#elif N1_LAYERS > 1
+	nnet::lstm_stack<input_t, result_t, N1_LAYERS, stack_lstm1>(lstm_in, lstm1_wx, lstm1_wh, lstm1_wb, lstm1_out);
+#else
 	nnet::lstm<input_t, result_t, config1, config2, config_x, config_h>(lstm_in, lstm1_wx, lstm1_wh, lstm1_wb, lstm1_out);
+#endif
 
 #ifndef __SYNTHESIS__
     if (DEBUG==1) {
     	std::cout <<"\n LSTM layer 1 output ";
-    	for(int ff = 0; ff < N1_LH*N_TS; ff++) {
+    	for(int ff = 0; ff < N1_LH; ff++) {
     		std::cout <<", "<< lstm1_out[ff];
     	}
     }
@@ -74,8 +148,24 @@ void lstm(
 	//	}
 	//}
 
+#if TD_DEFERRED
+    // LSTM with seq=true, then the TimeDistributed Dense over all timesteps
+#if USE_GRU
+    nnet::gru_seq<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2>(repeat_out, lstm2_wx, lstm2_wh, lstm2_wb, lstm2_out);
+#elif N2_LAYERS > 1
+    nnet::lstm_stack<input_t, result_t, N2_LAYERS, stack_lstm2>(repeat_out, lstm2_wx, lstm2_wh, lstm2_wb, lstm2_out);
+#else
+    nnet::lstm_seq<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2>(repeat_out, lstm2_wx, lstm2_wh, lstm2_wb, lstm2_out);
+#endif
+    nnet::dense_td<result_t, result_t, config3, N_TS>(lstm2_out, lstm_out, dense1_w, dense1_b);
+#else
     // LSTM + TimeDistributed Dense
+#if USE_GRU
+    nnet::gru_seq_td<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2, config3>(repeat_out, lstm2_wx, lstm2_wh, lstm2_wb, dense1_w, dense1_b, lstm_out);
+#else
     nnet::lstm_seq_td<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2, config3>(repeat_out, lstm2_wx, lstm2_wh, lstm2_wb, dense1_w, dense1_b, lstm_out);
+#endif
+#endif
 
 #ifndef __SYNTHESIS__
     if (DEBUG==1) {
@@ -89,3 +179,176 @@ void lstm(
 
 }
 
+#if IO_SERIAL
+// Streaming variant of ae_infer: the layers are connected through FIFOs and
+// only the cell states are kept in registers.
+void ae_read_input(input_t lstm_in[N_TS*N1_LX], hls::stream<input_t> &out){
+	for(int ii = 0; ii < N_TS*N1_LX; ii++){
+		#pragma HLS PIPELINE II=1
+		out.write(lstm_in[ii]);
+	}
+}
+
+void ae_repeat(hls::stream<result_t> &in, hls::stream<input_t> &out){
+	input_t latent[N1_LH];
+	#pragma HLS ARRAY_PARTITION variable=latent complete
+	for(int jj = 0; jj < N1_LH; jj++){
+		#pragma HLS PIPELINE II=1
+		latent[jj] = in.read();
+	}
+	for(int ii = 0; ii < N_TS; ii++){
+		for(int jj = 0; jj < N1_LH; jj++){
+			#pragma HLS PIPELINE II=1
+			out.write(latent[jj]);
+		}
+	}
+}
+
+void ae_write_output(hls::stream<result_t> &in, result_t lstm_out[MODEL_OUT]){
+	for(int ii = 0; ii < MODEL_OUT; ii++){
+		#pragma HLS PIPELINE II=1
+		lstm_out[ii] = in.read();
+	}
+}
+
+void ae_infer_serial(
+		input_t lstm_in[N_TS*N1_LX],
+		result_t lstm_out[MODEL_OUT]
+){
+	#pragma HLS DATAFLOW
+
+	hls::stream<input_t> in_s("in_s");
+	hls::stream<result_t> lstm1_s("lstm1_s");
+	hls::stream<input_t> repeat_s("repeat_s");
+	hls::stream<result_t> out_s("out_s");
+	#pragma HLS STREAM variable=lstm1_s depth=N1_LH
+	#pragma HLS STREAM variable=repeat_s depth=N1_LH
+#if TD_DEFERRED
+	hls::stream<result_t> lstm2_s("lstm2_s");
+	#pragma HLS STREAM variable=lstm2_s depth=N2_LH
+#endif
+
+	ae_read_input(lstm_in, in_s);
+#if USE_GRU
+	nnet::gru<input_t, result_t, config1, config2, config_x, config_h>(in_s, lstm1_wx, lstm1_wh, lstm1_wb, lstm1_s);
+#else
+	nnet::lstm_stack<input_t, result_t, N1_LAYERS, stack_lstm1>(in_s, lstm1_wx, lstm1_wh, lstm1_wb, lstm1_s);
+#endif
+	ae_repeat(lstm1_s, repeat_s);
+#if TD_DEFERRED
+#if USE_GRU
+	nnet::gru_seq<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2>(repeat_s, lstm2_wx, lstm2_wh, lstm2_wb, lstm2_s);
+#else
+	nnet::lstm_stack<input_t, result_t, N2_LAYERS, stack_lstm2>(repeat_s, lstm2_wx, lstm2_wh, lstm2_wb, lstm2_s);
+#endif
+	nnet::dense_td<result_t, result_t, config3, N_TS>(lstm2_s, out_s, dense1_w, dense1_b);
+#else
+#if USE_GRU
+	nnet::gru_seq_td<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2, config3>(repeat_s, lstm2_wx, lstm2_wh, lstm2_wb, dense1_w, dense1_b, out_s);
+#else
+	nnet::lstm_seq_td<input_t, result_t, config1_lstm2, config2_lstm2, config_x_lstm2, config_h_lstm2, config3>(repeat_s, lstm2_wx, lstm2_wh, lstm2_wb, dense1_w, dense1_b, out_s);
+#endif
+#endif
+	ae_write_output(out_s, lstm_out);
+}
+#endif
+
+#pragma hls_design top
+void lstm(
+		input_t lstm_in[N_TS*N1_LX],
+		result_t lstm_out[MODEL_OUT]
+#if RUNTIME_WEIGHTS
+		, model_default_t weights_in[N_WEIGHTS],
+		int load_weights
+#endif
+){
+#if RUNTIME_WEIGHTS
+	// The weights start out as the compiled-in arrays and are replaced by
+	// each load_weights call
+	if (load_weights) {
+		ae_load_weights(weights_in);
+		return;
+	}
+#endif
+#if IO_SERIAL
+	ae_infer_serial(lstm_in, lstm_out);
+#else
+	ae_infer(lstm_in, lstm_out);
+#endif
+}
+
+
+// Sliding windows built on-chip from a raw sample series: the samples go
+// through a shift register of N_TS samples, and every stride samples, once
+// it is full, the window it holds is scored. Window k covers samples
+// k*stride .. k*stride+N_TS-1; results[k*MODEL_OUT ..] gets its output.
+// The host sends each sample once instead of N_TS/stride times.
+void ae_series(
+		input_t *samples,
+		result_t *results,
+		int n_samples,
+		int stride
+){
+	input_t window[N_TS*N1_LX];
+	result_t window_out[MODEL_OUT];
+	#pragma HLS ARRAY_PARTITION variable=window complete
+
+	if (stride < 1) stride = 1;
+	int filled = 0;   // samples in the shift register, up to N_TS
+	int skip = 0;     // samples until the next window is complete
+	int n_windows = 0;
+
+	SAMPLES:
+	for(int ss = 0; ss < n_samples; ss++){
+		#pragma HLS LOOP_TRIPCOUNT min=N_TS max=65536
+		SHIFT:
+		for(int ii = 0; ii < (N_TS-1)*N1_LX; ii++){
+			#pragma HLS UNROLL
+			window[ii] = window[ii+N1_LX];
+		}
+		LOAD:
+		for(int jj = 0; jj < N1_LX; jj++){
+			#pragma HLS PIPELINE II=1
+			window[(N_TS-1)*N1_LX+jj] = samples[ss*N1_LX+jj];
+		}
+		if (filled < N_TS) filled++;
+		if (filled < N_TS) continue;
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		skip = stride - 1;
+
+#if IO_SERIAL
+		ae_infer_serial(window, window_out);
+#else
+		ae_infer(window, window_out);
+#endif
+		STORE:
+		for(int ii = 0; ii < MODEL_OUT; ii++){
+			#pragma HLS PIPELINE II=1
+			results[n_windows*MODEL_OUT+ii] = window_out[ii];
+		}
+		n_windows++;
+	}
+}
+
+void lstm_series(
+		input_t *samples,
+		result_t *results,
+		int n_samples,
+		int stride
+#if RUNTIME_WEIGHTS
+		, model_default_t weights_in[N_WEIGHTS],
+		int load_weights
+#endif
+){
+#if RUNTIME_WEIGHTS
+	// this kernel has its own copy of the weights, loaded like lstm's
+	if (load_weights) {
+		ae_load_weights(weights_in);
+		return;
+	}
+#endif
+	ae_series(samples, results, n_samples, stride);
+}
@@ -20,6 +20,24 @@ extern "C"{
 		//model_default_t weights_h[N_LH*N_LH*4],
 		//model_default_t bias[N_LH*4],
 		result_t conv_out[MODEL_OUT]
+#if RUNTIME_WEIGHTS
+		, model_default_t weights_in[N_WEIGHTS],
+		int load_weights
+#endif
+					);
+
+	// Sliding-window mode: scores the windows of n_samples raw samples
+	// (N1_LX values each), one every stride samples, into
+	// ((n_samples - N_TS) / stride + 1) * MODEL_OUT results
+	void lstm_series(
+		input_t *samples,
+		result_t *results,
+		int n_samples,
+		int stride
+#if RUNTIME_WEIGHTS
+		, model_default_t weights_in[N_WEIGHTS],
+		int load_weights
+#endif
 					);
 }
 #endif /* _LSTM_H_ */
@@ -69,74 +69,158 @@ int FPGA_LSTM::fpga_init(std::string binaryFile) {
   for (int i = 0; i < NUM_CU; i++) {
     OCL_CHECK(err, lstm[i] = cl::Kernel(m_prog, "lstm", & err));
   }
+  // optional: xclbins built before the sliding-window kernel lack it
+  m_series = cl::Kernel(m_prog, "lstm_series", & err);
+  m_has_series = (err == CL_SUCCESS);
+
+#if RUNTIME_WEIGHTS
+  OCL_CHECK(err, m_weights_buf = cl::Buffer(m_context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY, sizeof(model_default_t) * N_WEIGHTS, NULL, & err));
+#endif
+
+  alloc_buffers();
 
   printf("Application compiled with NUM_CU = %d\n", NUM_CU);
 
   return 0;
 }
 
-void FPGA_LSTM::run(input_t * inputs, result_t * results) {
+// Device buffers for every CU, created and mapped once: run() then only
+// copies, launches and waits, with no allocation or mapping per call
+void FPGA_LSTM::alloc_buffers() {
 
-//	std::vector<std::pair<data_t, int>> distances;
-  
   cl_int err;
-  std::vector < cl::Buffer > in_buf(NUM_CU);
-  std::vector < cl::Buffer > out_buf(NUM_CU);
-  input_t * host_write_ptr_in[NUM_CU];
-  result_t * host_read_ptr_out[NUM_CU];
 
   //measure fpga buffer allocation
-  TIMER_START(2); 
-  
-std::vector < input_t, aligned_allocator < input_t > > lstm_in(N_TS * N1_LX);
-std::vector < result_t, aligned_allocator < result_t > > lstm_out(MODEL_OUT);
-
+  TIMER_START(2);
   for (int i = 0; i < NUM_CU; i++) {
-    OCL_CHECK(err, in_buf[i] = cl::Buffer(m_context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY, sizeof(input_t) * N_TS * N1_LX, NULL, & err));
-    OCL_CHECK(err, out_buf[i] = cl::Buffer(m_context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_WRITE_ONLY, sizeof(result_t) * MODEL_OUT, NULL, & err));
+    OCL_CHECK(err, m_in_buf[i] = cl::Buffer(m_context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY, sizeof(input_t) * N_TS * N1_LX, NULL, & err));
+    OCL_CHECK(err, m_out_buf[i] = cl::Buffer(m_context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_WRITE_ONLY, sizeof(result_t) * MODEL_OUT, NULL, & err));
+    m_in_mem[i].assign(1, m_in_buf[i]);
+    m_out_mem[i].assign(1, m_out_buf[i]);
   }
+  set_args(0);
 
-  // Setting kernel arguments. Must be initialized before enqueueMapBuffer
   for (int i = 0; i < NUM_CU; i++) {
-    int narg = 0;
-    OCL_CHECK(err, err = lstm[i].setArg(narg++, in_buf[i]));
-    OCL_CHECK(err, err = lstm[i].setArg(narg++, out_buf[i]));
+    m_host_in[i] = (input_t * ) m_q.enqueueMapBuffer(m_in_buf[i], CL_TRUE, CL_MAP_WRITE, 0, sizeof(input_t) * N_TS * N1_LX);
+    m_host_out[i] = (result_t * ) m_q.enqueueMapBuffer(m_out_buf[i], CL_TRUE, CL_MAP_READ, 0, sizeof(result_t) * MODEL_OUT);
   }
 
+  if (m_has_series) {
+    // written and read with enqueueWrite/ReadBuffer, not mapped
+    OCL_CHECK(err, m_series_in_buf = cl::Buffer(m_context, CL_MEM_READ_ONLY, sizeof(input_t) * SERIES_CHUNK * N1_LX, NULL, & err));
+    OCL_CHECK(err, m_series_out_buf = cl::Buffer(m_context, CL_MEM_WRITE_ONLY, sizeof(result_t) * SERIES_MAX_WINDOWS * MODEL_OUT, NULL, & err));
+    OCL_CHECK(err, err = m_series.setArg(0, m_series_in_buf));
+    OCL_CHECK(err, err = m_series.setArg(1, m_series_out_buf));
+    OCL_CHECK(err, err = m_series.setArg(2, 0));
+    OCL_CHECK(err, err = m_series.setArg(3, 1));
+#if RUNTIME_WEIGHTS
+    OCL_CHECK(err, err = m_series.setArg(4, m_weights_buf));
+    OCL_CHECK(err, err = m_series.setArg(5, 0));
+#endif
+  }
+  TIMER_STOP;
+}
+
+// Setting kernel arguments. Must be initialized before enqueueMapBuffer
+void FPGA_LSTM::set_args(int load_weights) {
+
+  cl_int err;
   for (int i = 0; i < NUM_CU; i++) {
-    host_write_ptr_in[i] = (input_t * ) m_q.enqueueMapBuffer(in_buf[i], CL_TRUE, CL_MAP_WRITE, 0, sizeof(input_t) * N_TS * N1_LX);
-    host_read_ptr_out[i] = (result_t * ) m_q.enqueueMapBuffer(out_buf[i], CL_TRUE, CL_MAP_READ, 0, sizeof(result_t) * MODEL_OUT);
+    int narg = 0;
+    OCL_CHECK(err, err = lstm[i].setArg(narg++, m_in_buf[i]));
+    OCL_CHECK(err, err = lstm[i].setArg(narg++, m_out_buf[i]));
+#if RUNTIME_WEIGHTS
+    OCL_CHECK(err, err = lstm[i].setArg(narg++, m_weights_buf));
+    OCL_CHECK(err, err = lstm[i].setArg(narg++, load_weights));
+#endif
   }
+}
 
-  TIMER_STOP;
-  
-  TIMER_START(3);
-memcpy(host_write_ptr_in[0], &inputs[0], sizeof(input_t) * N_TS * N1_LX);
-     
-            //data_t dist = DTWDistance(training_data + i*N_FEATURES, input_data, W);  
-            
-            OCL_CHECK(err, err = m_q.enqueueMigrateMemObjects({
-              in_buf[0]
-            }, 0));
-            OCL_CHECK(err, err = m_q.enqueueTask(lstm[0]));
-            OCL_CHECK(err, err = m_q.enqueueMigrateMemObjects({
-              out_buf[0]
-            }, CL_MIGRATE_MEM_OBJECT_HOST));
-            OCL_CHECK(err, err = m_q.finish());
-            //retrieve the lstm_output from the output ptr 
-        	memcpy(&results[0], host_read_ptr_out[0], sizeof(result_t) * MODEL_OUT);
+FPGA_LSTM::~FPGA_LSTM() {
 
-  TIMER_STOP;
-  
+  if (!m_host_in[0]) return;
+  cl_int err;
   //measure buffer deallocation time
   TIMER_START(4);
   for (int i = 0; i < NUM_CU; i++) {
-    OCL_CHECK(err, err = m_q.enqueueUnmapMemObject(in_buf[i], host_write_ptr_in[i]));
-    OCL_CHECK(err, err = m_q.enqueueUnmapMemObject(out_buf[i], host_read_ptr_out[i]));
+    OCL_CHECK(err, err = m_q.enqueueUnmapMemObject(m_in_buf[i], m_host_in[i]));
+    OCL_CHECK(err, err = m_q.enqueueUnmapMemObject(m_out_buf[i], m_host_out[i]));
   }
   OCL_CHECK(err, err = m_q.finish());
   TIMER_STOP;
-  
-  
+}
+
+void FPGA_LSTM::run(input_t * inputs, result_t * results) {
+
+  cl_int err;
+
+  TIMER_START(3);
+  memcpy(m_host_in[0], &inputs[0], sizeof(input_t) * N_TS * N1_LX);
+
+  OCL_CHECK(err, err = m_q.enqueueMigrateMemObjects(m_in_mem[0], 0));
+  OCL_CHECK(err, err = m_q.enqueueTask(lstm[0]));
+  OCL_CHECK(err, err = m_q.enqueueMigrateMemObjects(m_out_mem[0], CL_MIGRATE_MEM_OBJECT_HOST));
+  OCL_CHECK(err, err = m_q.finish());
+  //retrieve the lstm_output from the output ptr
+  memcpy(&results[0], m_host_out[0], sizeof(result_t) * MODEL_OUT);
+  TIMER_STOP;
+
   return;
 }
+
+int FPGA_LSTM::run_series(input_t * samples, int n_samples, int stride, result_t * results) {
+
+  if (!m_has_series) return -1;
+  if (n_samples > SERIES_CHUNK) n_samples = SERIES_CHUNK;
+  if (stride < 1) stride = 1;
+  const int n_windows = n_samples < N_TS ? 0 : (n_samples - N_TS) / stride + 1;
+  if (n_windows == 0) return 0;
+
+  cl_int err;
+
+  TIMER_START(3);
+  OCL_CHECK(err, err = m_series.setArg(2, n_samples));
+  OCL_CHECK(err, err = m_series.setArg(3, stride));
+
+  // straight from/to the caller's arrays, and only the samples and windows
+  // of this call cross PCIe
+  OCL_CHECK(err, err = m_q.enqueueWriteBuffer(m_series_in_buf, CL_FALSE, 0, sizeof(input_t) * n_samples * N1_LX, samples));
+  OCL_CHECK(err, err = m_q.enqueueTask(m_series));
+  OCL_CHECK(err, err = m_q.enqueueReadBuffer(m_series_out_buf, CL_FALSE, 0, sizeof(result_t) * n_windows * MODEL_OUT, results));
+  OCL_CHECK(err, err = m_q.finish());
+  TIMER_STOP;
+
+  return n_windows;
+}
+
+#if RUNTIME_WEIGHTS
+int FPGA_LSTM::load_weights(model_default_t * weights) {
+
+  cl_int err;
+
+  model_default_t * host_weights_ptr = (model_default_t * ) m_q.enqueueMapBuffer(m_weights_buf, CL_TRUE, CL_MAP_WRITE, 0, sizeof(model_default_t) * N_WEIGHTS);
+  memcpy(host_weights_ptr, weights, sizeof(model_default_t) * N_WEIGHTS);
+  OCL_CHECK(err, err = m_q.enqueueUnmapMemObject(m_weights_buf, host_weights_ptr));
+  OCL_CHECK(err, err = m_q.enqueueMigrateMemObjects({
+    m_weights_buf
+  }, 0));
+
+  // every CU keeps its own copy of the weights; the input/output arguments
+  // are not touched by a load call
+  set_args(1);
+  for (int i = 0; i < NUM_CU; i++) {
+    OCL_CHECK(err, err = m_q.enqueueTask(lstm[i]));
+  }
+  if (m_has_series) {
+    OCL_CHECK(err, err = m_series.setArg(5, 1));
+    OCL_CHECK(err, err = m_q.enqueueTask(m_series));
+  }
+  OCL_CHECK(err, err = m_q.finish());
+  set_args(0);
+  if (m_has_series) {
+    OCL_CHECK(err, err = m_series.setArg(5, 0));
+  }
+
+  return 0;
+}
+#endif
@@ -4,19 +4,49 @@
 
 #define NUM_CU 1
 
+// Samples sent per lstm_series call
+#define SERIES_CHUNK (1 << 16)
+#define SERIES_MAX_WINDOWS (SERIES_CHUNK - N_TS + 1)
+
 class FPGA_LSTM {
   public:
+    FPGA_LSTM() : m_has_series(false) { m_host_in[0] = NULL; }
+    ~FPGA_LSTM();
     void run(input_t * inputs, result_t * results);
+    // Score the windows of n_samples (<= SERIES_CHUNK) raw samples, one
+    // every stride samples, with the windows built on the device. Returns
+    // the number of windows, -1 if the xclbin has no lstm_series kernel.
+    int run_series(input_t * samples, int n_samples, int stride, result_t * results);
+    bool has_series() const { return m_has_series; }
     int fpga_init(string binaryFile);
     int print_performance_report();
+#if RUNTIME_WEIGHTS
+    // Replace the resident weights with a packed buffer of N_WEIGHTS values
+    int load_weights(model_default_t * weights);
+#endif
     //int *memberships = new int[N_SERIES];
         
     
   private:
+    void alloc_buffers();
+    void set_args(int load_weights);
 
     cl::Context m_context;
     cl::CommandQueue m_q;
     cl::Program m_prog;
     cl::Kernel lstm[NUM_CU];
+    cl::Buffer m_in_buf[NUM_CU];
+    cl::Buffer m_out_buf[NUM_CU];
+    std::vector<cl::Memory> m_in_mem[NUM_CU];    // migration lists, built once
+    std::vector<cl::Memory> m_out_mem[NUM_CU];
+    input_t * m_host_in[NUM_CU];                 // mapped m_in_buf/m_out_buf
+    result_t * m_host_out[NUM_CU];
+    bool m_has_series;
+    cl::Kernel m_series;
+    cl::Buffer m_series_in_buf;
+    cl::Buffer m_series_out_buf;
+#if RUNTIME_WEIGHTS
+    cl::Buffer m_weights_buf;
+#endif
 
 };
@@ -28,18 +28,33 @@
  * @def N_TS
  * @brief Number of timesteps for the LSTM layers.
  *
+ * @def USE_GRU
+ * @brief Build the autoencoder from GRU layers (nnet_gru.h) instead of LSTM layers.
+ *
+ * @def RNN_GATES
+ * @brief Gates per recurrent cell: 4 for the LSTM, 3 for the GRU.
+ *
+ * @def RNN_BIASES
+ * @brief Bias vectors per recurrent cell: 4 for the LSTM, 6 (input and recurrent) for the GRU.
+ *
  * @def N1_LX
  * @brief Input size for the first LSTM layer.
  *
  * @def N1_LH
  * @brief Hidden size for the first LSTM layer.
  *
+ * @def N1_LAYERS
+ * @brief Number of stacked layers in the first LSTM (num_layers of the nn.LSTM), run by nnet::lstm_stack.
+ *
  * @def N2_LX
  * @brief Input size for the second LSTM layer, equal to the hidden size of the first layer.
  *
  * @def N2_LH
  * @brief Hidden size for the second LSTM layer.
  *
+ * @def N2_LAYERS
+ * @brief Number of stacked layers in the second LSTM (num_layers of the nn.LSTM), run by nnet::lstm_stack.
+ *
  * @def DENSE1_OUT
  * @brief Output size for the dense layer, equal to the input size of the first LSTM layer.
  *
@@ -50,7 +65,7 @@
  * @brief Total output size of the model, defined as DENSE1_OUT * N_TS.
  *
  * @def R_TS
- * @brief Reuse factor for timesteps, where N_TS means no unroll.
+ * @brief Reuse factor for timesteps, where N_TS means no unroll and 1 unrolls every timestep.
  *
  * @def R1_H
  * @brief Reuse factor for hidden layers in the first LSTM layer.
@@ -73,6 +88,24 @@
  * @def R_DENSE1
  * @brief Reuse factor for the dense layer.
  *
+ * @def RUNTIME_WEIGHTS
+ * @brief Load the weights at runtime into on-chip RAM instead of compiling them in.
+ *
+ * @def N_WEIGHTS
+ * @brief Size of the packed weight buffer; the *_OFFSET macros give the position of each array in it.
+ *
+ * @def ACCUM_H
+ * @brief Accumulation type (serial chain or adder tree) for the hidden state projections.
+ *
+ * @def ACTIV_IMPL
+ * @brief Sigmoid/tanh implementation of the LSTM gates (see nnet::activ_impl_type).
+ *
+ * @def TD_DEFERRED
+ * @brief Run the TimeDistributed dense once over all timesteps after the second LSTM layer.
+ *
+ * @def IO_SERIAL
+ * @brief Chain the layers through hls::stream FIFOs instead of partitioned arrays.
+ *
  * @typedef act_default_t
  * @brief Default data type for activations, set to float.
  *
@@ -133,11 +166,16 @@
 #include "ap_fixed.h"
 
 #include "../nnet_utils/nnet_lstm.h"
+#include "../nnet_utils/nnet_gru.h"
 #include "../nnet_utils/nnet_activation.h"
 #include "../nnet_utils/nnet_dense.h"
 
-// Debug flag to enable or disable debug output.
-#define DEBUG 1
+// Debug flag to enable or disable debug output. Off by default: ae_infer
+// prints every layer's output, two lines per window in the batch runners;
+// build with -DDEBUG=1 to trace a single window.
+#ifndef DEBUG
+#define DEBUG 0
+#endif
 
 // Total and integer bits for the activation data type. (not used when float)
 #define ACT_TTL_BIT 16
@@ -150,18 +188,50 @@
 // Number of timesteps for the LSTM layers.
 #define N_TS 8 
 
+// Recurrent cell of both layers. The GRU weights are exported under
+// HLS_AE_SMALL_GRU/ with the same array names as the LSTM ones, and have 3
+// gates and separate input/recurrent biases (see nnet_gru.h).
+#ifndef USE_GRU
+#define USE_GRU 0
+#endif
+#if USE_GRU
+#define RNN_GATES  3
+#define RNN_BIASES 6
+#else
+#define RNN_GATES  4
+#define RNN_BIASES 4
+#endif
+
 // Input size for the first LSTM layer.
 #define N1_LX 1
 
 // Hidden size for the first LSTM layer.
 #define N1_LH 9
 
+// Stacked layers in the first LSTM, num_layers of the PyTorch nn.LSTM
+// (models/rae.py trains with 2). Layers after the first take N1_LH inputs;
+// their weights follow the first layer's in lstm1_wx/wh/wb.
+#ifndef N1_LAYERS
+#define N1_LAYERS 1
+#endif
+#define N1_WX_SIZE ((N1_LX + (N1_LAYERS - 1) * N1_LH) * N1_LH * RNN_GATES)
+#define N1_WH_SIZE (N1_LAYERS * N1_LH * N1_LH * RNN_GATES)
+#define N1_WB_SIZE (N1_LAYERS * N1_LH * RNN_BIASES)
+
 // Input size for the second LSTM layer (equal to the hidden size of the first layer).
 #define N2_LX N1_LH
 
 // Hidden size for the second LSTM layer.
 #define N2_LH 9
 
+// Stacked layers in the second LSTM, as N1_LAYERS for the first.
+#ifndef N2_LAYERS
+#define N2_LAYERS 1
+#endif
+#define N2_WX_SIZE ((N2_LX + (N2_LAYERS - 1) * N2_LH) * N2_LH * RNN_GATES)
+#define N2_WH_SIZE (N2_LAYERS * N2_LH * N2_LH * RNN_GATES)
+#define N2_WB_SIZE (N2_LAYERS * N2_LH * RNN_BIASES)
+
 // Output size for the dense layer (equal to the input size of the first LSTM layer).
 #define DENSE1_OUT N1_LX
 
@@ -171,8 +241,9 @@
 // Total model output size (DENSE1_OUT * N_TS).
 #define MODEL_OUT DENSE1_OUT * N_TS
 
-// Reuse factor for timesteps. N_TS means no unroll.
-#define R_TS 1 
+// Reuse factor for timesteps, i.e. timesteps sharing one LSTM cell datapath.
+// N_TS means no unroll, 1 replicates the cell for every timestep.
+#define R_TS N_TS
 
 // Reuse factors for hidden layers in the first and second LSTM layers.
 #define R1_H 1
@@ -189,6 +260,58 @@
 // Reuse factor for the dense layer.
 #define R_DENSE1 1
 
+// Keep the weights in on-chip RAM, loaded at runtime through the kernel's
+// weights_in buffer, instead of compiling them into the bitstream.
+#ifndef RUNTIME_WEIGHTS
+#define RUNTIME_WEIGHTS 0
+#endif
+
+// Layout of the packed weight buffer used when RUNTIME_WEIGHTS is set.
+#define LSTM1_WX_OFFSET 0
+#define LSTM1_WH_OFFSET (LSTM1_WX_OFFSET + N1_WX_SIZE)
+#define LSTM1_WB_OFFSET (LSTM1_WH_OFFSET + N1_WH_SIZE)
+#define LSTM2_WX_OFFSET (LSTM1_WB_OFFSET + N1_WB_SIZE)
+#define LSTM2_WH_OFFSET (LSTM2_WX_OFFSET + N2_WX_SIZE)
+#define LSTM2_WB_OFFSET (LSTM2_WH_OFFSET + N2_WH_SIZE)
+#define DENSE1_W_OFFSET (LSTM2_WB_OFFSET + N2_WB_SIZE)
+#define DENSE1_B_OFFSET (DENSE1_W_OFFSET + DENSE1_IN * DENSE1_OUT)
+#define N_WEIGHTS       (DENSE1_B_OFFSET + DENSE1_OUT)
+
+// Accumulation of the recurrent (hidden state) projections. An adder tree
+// shortens the per-timestep critical path from N_LH to log2(N_LH) adds, but
+// sums in a different order, so float outputs change in the last bits.
+#ifndef ACCUM_H
+#define ACCUM_H nnet::accum_serial
+#endif
+
+// Sigmoid/tanh implementation of the gates: full table, bit-sliced table,
+// interpolated small table, piecewise linear, polynomial, one tanh table
+// shared by all four gates (nnet::activ_lut_shared), or float-exact
+// (nnet::activ_exact, matches the PyTorch model of mounted_dir/models).
+#ifndef ACTIV_IMPL
+#define ACTIV_IMPL nnet::activ_lut
+#endif
+
+// Take the TimeDistributed dense out of the second layer's recurrence: the
+// decoder returns its hidden sequence and nnet::dense_td projects all
+// timesteps at once, as a separate dataflow stage.
+#ifndef TD_DEFERRED
+#define TD_DEFERRED 1
+#endif
+
+// Connect the layers with streams, one element per beat, instead of
+// completely partitioned arrays (see the hls::stream overloads in nnet_lstm.h).
+#ifndef IO_SERIAL
+#define IO_SERIAL 0
+#endif
+
+#if (N1_LAYERS > 1 || N2_LAYERS > 1) && USE_GRU
+#error "stacked layers (nnet::lstm_stack) need the LSTM cell"
+#endif
+#if N2_LAYERS > 1 && !TD_DEFERRED
+#error "N2_LAYERS > 1 needs TD_DEFERRED: the TimeDistributed dense runs on the last layer's sequence"
+#endif
+
 // Default data type for activations, set to float.
 typedef float act_default_t;
 // typedef ap_fixed<ACT_TTL_BIT, ACT_INT_BIT, AP_RND, AP_SAT> act_default_t;
@@ -225,6 +348,7 @@ struct config1 : nnet::lstm_config {
 
     static const unsigned reuse_factor_tail = R1_TAIL;
     static const unsigned reuse_factor_ts = R_TS;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
     static const unsigned LSTM_DEBUG = DEBUG;
 
     typedef accum_lstm_t    bias_t;
@@ -236,6 +360,7 @@ struct config1 : nnet::lstm_config {
 // Configuration for the activation function following the first LSTM layer.
 struct config2 : nnet::activ_config {
     static const unsigned n_in = N1_LH;
+    static const unsigned activ_impl = ACTIV_IMPL;
     typedef model_default_t table_t;
     typedef act_default_t constant_t;
 };
@@ -248,8 +373,9 @@ struct config_x : nnet::dense_config {
     typedef mult_p_t        mult_t;
 
     static const unsigned reuse_factor = R1_X;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
     static const unsigned n_in = N1_LX;
-    static const unsigned n_out = N1_LH * 4;
+    static const unsigned n_out = N1_LH * RNN_GATES;
 };
 
 // Configuration for the dense layer applied to the hidden state of the first LSTM layer.
@@ -260,8 +386,10 @@ struct config_h : nnet::dense_config {
     typedef mult_p_t        mult_t;
 
     static const unsigned reuse_factor = R1_H;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
+    static const unsigned accum_type = ACCUM_H;
     static const unsigned n_in = N1_LH;
-    static const unsigned n_out = N1_LH * 4;
+    static const unsigned n_out = N1_LH * RNN_GATES;
 };
 
 // Configuration for the second LSTM layer.
@@ -272,6 +400,7 @@ struct config1_lstm2 : nnet::lstm_config {
 
     static const unsigned reuse_factor_tail = R2_TAIL;
     static const unsigned reuse_factor_ts = R_TS;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
     static const unsigned LSTM_DEBUG = DEBUG;
 
     typedef accum_lstm_t    bias_t;
@@ -283,6 +412,7 @@ struct config1_lstm2 : nnet::lstm_config {
 // Configuration for the activation function following the second LSTM layer.
 struct config2_lstm2 : nnet::activ_config {
     static const unsigned n_in = N2_LH;
+    static const unsigned activ_impl = ACTIV_IMPL;
     typedef model_default_t table_t;
     typedef act_default_t constant_t;
 };
@@ -295,8 +425,9 @@ struct config_x_lstm2 : nnet::dense_config {
     typedef mult_p_t        mult_t;
 
     static const unsigned reuse_factor = R2_X;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
     static const unsigned n_in = N2_LX;
-    static const unsigned n_out = N2_LH * 4;
+    static const unsigned n_out = N2_LH * RNN_GATES;
 };
 
 // Configuration for the dense layer applied to the hidden state of the second LSTM layer.
@@ -307,8 +438,82 @@ struct config_h_lstm2 : nnet::dense_config {
     typedef mult_p_t        mult_t;
 
     static const unsigned reuse_factor = R2_H;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
+    static const unsigned accum_type = ACCUM_H;
     static const unsigned n_in = N2_LH;
-    static const unsigned n_out = N2_LH * 4;
+    static const unsigned n_out = N2_LH * RNN_GATES;
+};
+
+// Configurations for the layers after the first in the first LSTM stack,
+// which take the hidden state of the layer below as input.
+struct config1_deep : config1 {
+    static const unsigned length_x = N1_LH;
+};
+
+struct config_x_deep : config_x {
+    static const unsigned n_in = N1_LH;
+};
+
+template<int L>
+struct layer_lstm1 {
+    typedef config1_deep  config;
+    typedef config2       activ_config;
+    typedef config_x_deep config_x;
+    typedef ::config_h    config_h;
+};
+
+template<>
+struct layer_lstm1<0> {
+    typedef config1    config;
+    typedef config2    activ_config;
+    typedef ::config_x config_x;
+    typedef ::config_h config_h;
+};
+
+// Configuration for the first LSTM as an N1_LAYERS stack, returning the
+// final hidden state of its last layer.
+struct stack_lstm1 : nnet::lstm_stack_config {
+    typedef accum_lstm_t    bias_t;
+    typedef model_default_t weight_t;
+    static const bool return_sequences = false;
+
+    template<int L>
+    struct layer : layer_lstm1<L> {};
+};
+
+// Configurations for the layers after the first in the second LSTM stack,
+// which take the hidden state of the layer below as input.
+struct config1_lstm2_deep : config1_lstm2 {
+    static const unsigned length_x = N2_LH;
+};
+
+struct config_x_lstm2_deep : config_x_lstm2 {
+    static const unsigned n_in = N2_LH;
+};
+
+template<int L>
+struct layer_lstm2 {
+    typedef config1_lstm2_deep config;
+    typedef config2_lstm2      activ_config;
+    typedef config_x_lstm2_deep config_x;
+    typedef config_h_lstm2     config_h;
+};
+
+template<>
+struct layer_lstm2<0> {
+    typedef config1_lstm2  config;
+    typedef config2_lstm2  activ_config;
+    typedef config_x_lstm2 config_x;
+    typedef config_h_lstm2 config_h;
+};
+
+// Configuration for the second LSTM as an N2_LAYERS stack.
+struct stack_lstm2 : nnet::lstm_stack_config {
+    typedef accum_lstm_t    bias_t;
+    typedef model_default_t weight_t;
+
+    template<int L>
+    struct layer : layer_lstm2<L> {};
 };
 
 // Configuration for the final dense layer applied after the second LSTM layer.
@@ -319,6 +524,7 @@ struct config3 : nnet::dense_config {
     typedef mult_p_t        mult_t;
 
     static const unsigned reuse_factor = R_DENSE1;
+    static const bool store_weights_in_bram = RUNTIME_WEIGHTS;
     static const unsigned n_in = DENSE1_IN;
     static const unsigned n_out = DENSE1_OUT;
 };
@@ -0,0 +1,197 @@
+#pragma once
+
+// Writer for the batch testbench output files: text, one window per line
+// ("index:v0,v1,...", index zero-padded to 5 digits, values as "%g"), or one
+// of the binary formats of batch_format.h. Windows of several sensors (a
+// window store replay) are written as "sensor:index:v0,v1,..." lines, or
+// as rows with the sensor in an extra first column.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include "parameters.h"
+#include "batch_format.h"
+#include "alloc_counter.h"
+
+// Format v like printf("%g") / std::ostream's default, return the end
+inline char* format_float(char* p, char* end, float v) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::to_chars_result r = std::to_chars(p, end, v, std::chars_format::general, 6);
+    if (r.ec == std::errc()) return r.ptr;
+#endif
+    int n = snprintf(p, end - p, "%g", v);
+    return n < 0 ? p : p + n;
+}
+
+// Formats the results into one of two fixed buffers; a full buffer is
+// handed to a background thread that writes it out while the other one
+// fills. Memory use is two buffers whatever the number of windows, and
+// the file grows as the run goes.
+class ResultWriter {
+  public:
+    explicit ResultWriter(size_t buffer_bytes = 8 << 20)
+        : m_file(NULL), m_rows(0), m_row_size(0), m_cur(0), m_len(0), m_pending(false), m_pending_buf(0), m_pending_len(0),
+          m_done(false), m_error(false) {
+        m_fmt.format = FORMAT_TEXT;
+        m_fmt.npy = false;
+        m_buf[0].resize(buffer_bytes);
+        m_buf[1].resize(buffer_bytes);
+    }
+    ~ResultWriter() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        m_file = fopen(path.c_str(), "wb");
+        if (!m_file) return false;
+        m_fmt = batch_file_from_path(path);
+        m_rows = 0;
+        m_row_size = 0;
+        m_done = false;
+        m_error = false;
+        // placeholder, rewritten with the final shape by close()
+        if (m_fmt.npy && !npy_write_header(m_file, m_fmt.format, 0, 0)) m_error = true;
+        m_thread = std::thread(&ResultWriter::writer_loop, this);
+        return true;
+    }
+
+    void write(size_t index, const result_t* values, size_t n) {
+        write_row(NULL, index, values, n);
+    }
+
+    // A window of one of several sensors. The binary formats store the
+    // sensor as a value, exact up to 2^24 in float32 and 2^11 in float16.
+    void write(uint32_t sensor, size_t index, const result_t* values, size_t n) {
+        write_row(&sensor, index, values, n);
+    }
+
+    // Write out what is left and wait for the file to be complete.
+    // Returns false if any write failed.
+    bool close() {
+        if (!m_file) return !m_error;
+        submit();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+        if (m_fmt.npy && (fseek(m_file, 0, SEEK_SET) != 0 || !npy_write_header(m_file, m_fmt.format, m_rows, m_row_size))) m_error = true;
+        if (fclose(m_file) != 0) m_error = true;
+        m_file = NULL;
+        return !m_error;
+    }
+
+  private:
+    void write_row(const uint32_t* sensor, size_t index, const result_t* values, size_t n) {
+        if (m_fmt.format != FORMAT_TEXT) {
+            write_binary(sensor, values, n);
+            return;
+        }
+        const size_t max_line = 36 + 16 * n;
+        if (m_len + max_line > m_buf[m_cur].size()) {
+            submit();
+            if (max_line > m_buf[m_cur].size()) m_buf[m_cur].resize(max_line);
+        }
+        char* p = &m_buf[m_cur][m_len];
+        char* end = &m_buf[m_cur][0] + m_buf[m_cur].size();
+        if (sensor) {
+            p = format_index(p, *sensor, 1);
+            *p++ = ':';
+        }
+        p = format_index(p, index);
+        *p++ = ':';
+        for (size_t j = 0; j < n; j++) {
+            if (j != 0) *p++ = ',';
+            p = format_float(p, end, (float) values[j]);
+        }
+        *p++ = '\n';
+        m_len = p - &m_buf[m_cur][0];
+    }
+
+    void write_binary(const uint32_t* sensor, const result_t* values, size_t n) {
+        const size_t elem = batch_elem_size(m_fmt.format);
+        const size_t cols = n + (sensor ? 1 : 0);
+        if (m_len + elem * cols > m_buf[m_cur].size()) {
+            submit();
+            if (elem * cols > m_buf[m_cur].size()) m_buf[m_cur].resize(elem * cols);
+        }
+        char* p = &m_buf[m_cur][m_len];
+        for (size_t j = 0; j < cols; j++) {
+            float v = sensor ? (j == 0 ? (float) *sensor : (float) values[j - 1]) : (float) values[j];
+            if (m_fmt.format == FORMAT_F16) {
+                uint16_t h = float_to_half(v);
+                memcpy(p + 2 * j, &h, 2);
+            } else {
+                memcpy(p + 4 * j, &v, 4);
+            }
+        }
+        m_len += elem * cols;
+        m_rows++;
+        m_row_size = cols;
+    }
+
+    static char* format_index(char* p, size_t index, int width = 5) {
+        char digits[20];
+        int n = 0;
+        do { digits[n++] = '0' + index % 10; index /= 10; } while (index);
+        for (int i = n; i < width; i++) *p++ = '0';
+        while (n) *p++ = digits[--n];
+        return p;
+    }
+
+    // Hand the current buffer to the writer thread and continue in the
+    // other one, once the thread is done with it
+    void submit() {
+        if (m_len == 0) return;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return !m_pending; });
+            m_pending = true;
+            m_pending_buf = m_cur;
+            m_pending_len = m_len;
+        }
+        m_cv.notify_all();
+        m_cur ^= 1;
+        m_len = 0;
+    }
+
+    void writer_loop() {
+        alloc_count_exclude_thread();   // an I/O thread, see batch_pipeline.h
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cv.wait(lock, [this] { return m_pending || m_done; });
+            if (!m_pending) break;
+            const char* data = &m_buf[m_pending_buf][0];
+            const size_t len = m_pending_len;
+            lock.unlock();
+            if (fwrite(data, 1, len, m_file) != len) m_error = true;
+            lock.lock();
+            m_pending = false;
+            m_cv.notify_all();
+        }
+    }
+
+    FILE* m_file;
+    BatchFile m_fmt;
+    size_t m_rows;
+    size_t m_row_size;
+    std::vector<char> m_buf[2];
+    int m_cur;                 // buffer being filled, the other one may be in flight
+    size_t m_len;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_pending;            // m_buf[m_pending_buf] waits for / is being written
+    int m_pending_buf;
+    size_t m_pending_len;
+    bool m_done;
+    bool m_error;
+};
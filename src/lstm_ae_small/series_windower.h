@@ -0,0 +1,77 @@
+#pragma once
+
+// Windows of a continuous sample series (one sensor), for callers that
+// have the raw series instead of pre-cut windows: a window is N_TS
+// consecutive samples of N1_LX values, and a new one starts every stride
+// samples (1: sliding, N_TS: tumbling).
+//
+// Samples are kept in a ring buffer whose first N_TS - 1 positions are
+// mirrored past its end, so every window is a contiguous view into the
+// ring: a sample is stored once (twice near the wrap) however many
+// windows it belongs to.
+
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "parameters.h"
+
+class SeriesWindower {
+  public:
+    static const size_t window_samples = N_TS;
+    static const size_t sample_size = N1_LX;
+
+    // capacity: samples kept, at least one window
+    explicit SeriesWindower(size_t stride, size_t capacity = 1 << 16)
+        : m_stride(std::max<size_t>(stride, 1)), m_capacity(capacity > window_samples ? capacity : window_samples),
+          m_ring((m_capacity + window_samples - 1) * sample_size),
+          m_written(0), m_next(0), m_released(0) {}
+
+    size_t stride() const { return m_stride; }
+
+    // Append up to n samples (n * N1_LX values). Returns how many were
+    // taken: samples of windows handed out and not yet released are
+    // never overwritten.
+    size_t push(const input_t* samples, size_t n) {
+        const uint64_t limit = m_released + m_capacity;
+        n = std::min<uint64_t>(n, limit - m_written);
+        for (size_t s = 0; s < n; s++, m_written++) {
+            const size_t pos = m_written % m_capacity;
+            memcpy(&m_ring[pos * sample_size], &samples[s * sample_size], sample_size * sizeof(input_t));
+            if (pos < window_samples - 1) {
+                memcpy(&m_ring[(m_capacity + pos) * sample_size], &samples[s * sample_size], sample_size * sizeof(input_t));
+            }
+        }
+        return n;
+    }
+
+    // Hand out up to max complete windows as views into the ring, with the
+    // number of their first sample. The views stay valid until release().
+    size_t windows(input_t** views, uint64_t* first_sample, size_t max) {
+        size_t n = 0;
+        while (n < max && m_next + window_samples <= m_written) {
+            views[n] = &m_ring[(m_next % m_capacity) * sample_size];
+            first_sample[n] = m_next;
+            m_next += m_stride;
+            n++;
+        }
+        return n;
+    }
+
+    // The n oldest windows handed out are done with
+    void release(size_t n) {
+        m_released = std::min<uint64_t>(m_released + n * m_stride, m_next);
+    }
+
+    // Samples received so far
+    uint64_t samples() const { return m_written; }
+
+  private:
+    size_t m_stride;
+    size_t m_capacity;
+    std::vector<input_t> m_ring;   // m_capacity samples, then the first window_samples - 1 again
+    uint64_t m_written;            // samples received
+    uint64_t m_next;               // first sample of the next window
+    uint64_t m_released;           // first sample of the oldest window in use
+};
@@ -7,12 +7,285 @@
 #include "lstm.h"
 #include "HLS_AE_SMALL/input.h"
 #include "utils.h"
+#include "window_parser.h"
+#include "result_writer.h"
+#include "window_store.h"
+#include "batch_pipeline.h"
+#include "layer_checks.h"
+#include "io_checks.h"
 
 TIMER_INIT(6); //set number of timers to use
 
+#if RUNTIME_WEIGHTS
+// The resident weight arrays of lstm.cpp, the compiled-in values until a
+// load_weights call replaces them
+extern model_default_t lstm1_wx[N1_WX_SIZE], lstm1_wh[N1_WH_SIZE], lstm2_wx[N2_WX_SIZE], lstm2_wh[N2_WH_SIZE], dense1_w[DENSE1_IN * DENSE1_OUT];
+extern accum_lstm_t lstm1_wb[N1_WB_SIZE], lstm2_wb[N2_WB_SIZE], dense1_b[DENSE1_OUT];
+#endif
+
+// One window through the model. With RUNTIME_WEIGHTS the kernel also takes
+// the packed weight buffer, which inference (load_weights = 0) leaves unread.
+static void infer_window(input_t* in, result_t* out) {
+#if RUNTIME_WEIGHTS
+    lstm(in, out, NULL, 0);
+#else
+    lstm(in, out);
+#endif
+}
+
+// The model over a batch of windows, the infer stage of run_pipeline
+static void infer_batch(input_t* in, result_t* out, size_t n) {
+    for (size_t w = 0; w < n; w++) infer_window(&in[w * N_TS * N1_LX], &out[w * MODEL_OUT]);
+}
+
+// Run every window of input_file through the model and write the results
+// to output_file, in any of the formats of batch_format.h. A window store
+// (.lws) input only replays the windows selected by query, indexed by
+// sensor and time.
+int run_batch(const std::string& input_file, const std::string& output_file, const WindowQuery& query) {
+    const size_t tensor_size = N_TS * N1_LX;
+    const size_t batch_windows = 4096;
+
+    ResultWriter writer;
+    if (!writer.open(output_file)) {
+        std::cerr << "Unable to open file: " << output_file << std::endl;
+        return 1;
+    }
+    PipelineStats stats;
+    if (path_ends_with(input_file, ".lws")) {
+        WindowStore store;
+        if (!store.open(input_file) || store.tensor_size() != tensor_size) {
+            std::cerr << "Unable to read " << input_file << ": " << (store.error().empty() ? "window size does not match the model input" : store.error()) << std::endl;
+            return 1;
+        }
+        store.query(query);
+        std::cout << store.selected_chunks() << " of " << store.chunks().size() << " chunks selected\n";
+        stats = run_pipeline(store, writer, infer_batch, batch_windows);
+    } else {
+        WindowReader reader(tensor_size);
+        reader.set_threads(0);   // text is parsed on all cores
+        if (!reader.open(input_file)) {
+            std::cerr << "Unable to read " << input_file << ": " << reader.error() << std::endl;
+            return 1;
+        }
+        stats = run_pipeline(reader, writer, infer_batch, batch_windows);
+        if (reader.errors()) {
+            std::cerr << reader.errors() << " malformed input lines, missing values set to 0" << std::endl;
+        }
+    }
+
+    if (!writer.close()) {
+        std::cerr << "Error writing " << output_file << std::endl;
+        return 1;
+    }
+    stats.print();
+    return 0;
+}
+
+// Pseudo-random windows of one sensor, as a run_pipeline source
+struct GeneratedWindows {
+    size_t left;
+    layer_checks::check_rng rng;
+    uint64_t next;
+
+    size_t read(input_t* batch, size_t max_windows, uint64_t* index, uint32_t* sensor) {
+        const size_t n = std::min(left, max_windows);
+        for (size_t w = 0; w < n; w++) {
+            for (size_t i = 0; i < N_TS * N1_LX; i++) batch[w * N_TS * N1_LX + i] = (input_t) rng.next();
+            index[w] = next++;
+            sensor[w] = 0;
+        }
+        left -= n;
+        return n;
+    }
+};
+
+// Replay generated windows through run_pipeline: after the first batch,
+// inference must not allocate, counted over the whole process. The
+// IO_SERIAL build chains its layers through hls::stream FIFOs, which
+// allocate on every call in software, so it is not checked.
+bool check_infer_allocations() {
+    const char* name = "infer allocations (pipeline)";
+    if (!alloc_counting()) {
+        printf("  %-34s skipped, built without COUNT_ALLOCATIONS\n", name);
+        return true;
+    }
+    if (IO_SERIAL) {
+        printf("  %-34s skipped, IO_SERIAL streams allocate\n", name);
+        return true;
+    }
+    const size_t batch_windows = 256, n_windows = 4 * batch_windows;
+    ResultWriter writer;
+    if (!writer.open("/dev/null")) {
+        printf("  %-34s FAIL: unable to open /dev/null\n", name);
+        return false;
+    }
+    GeneratedWindows source = {n_windows, layer_checks::check_rng(48), 0};
+    PipelineStats stats = run_pipeline(source, writer, infer_batch, batch_windows, 0);
+    writer.close();
+    if (stats.windows != n_windows || stats.infer_allocs != 0) {
+        printf("  %-34s FAIL: %zu allocations in %zu windows\n", name, stats.infer_allocs, stats.windows);
+        return false;
+    }
+    printf("  %-34s ok\n", name);
+    return true;
+}
+
+#if RUNTIME_WEIGHTS
+// Pack the compiled-in weights in the N_WEIGHTS layout of parameters.h, load
+// a perturbed copy and then the packed one through lstm(.., load_weights = 1):
+// the first must change the outputs, the second restore them bit for bit
+bool check_runtime_weights() {
+    const char* name = "runtime weights (round trip)";
+    struct { model_default_t* w; size_t offset, n; } dense[] = {
+        {lstm1_wx, LSTM1_WX_OFFSET, N1_WX_SIZE}, {lstm1_wh, LSTM1_WH_OFFSET, N1_WH_SIZE},
+        {lstm2_wx, LSTM2_WX_OFFSET, N2_WX_SIZE}, {lstm2_wh, LSTM2_WH_OFFSET, N2_WH_SIZE},
+        {dense1_w, DENSE1_W_OFFSET, DENSE1_IN * DENSE1_OUT}};
+    struct { accum_lstm_t* b; size_t offset, n; } bias[] = {
+        {lstm1_wb, LSTM1_WB_OFFSET, N1_WB_SIZE}, {lstm2_wb, LSTM2_WB_OFFSET, N2_WB_SIZE},
+        {dense1_b, DENSE1_B_OFFSET, DENSE1_OUT}};
+    std::vector<model_default_t> packed(N_WEIGHTS), perturbed(N_WEIGHTS);
+    for (size_t k = 0; k < sizeof(dense) / sizeof(dense[0]); k++) {
+        for (size_t i = 0; i < dense[k].n; i++) packed[dense[k].offset + i] = dense[k].w[i];
+    }
+    for (size_t k = 0; k < sizeof(bias) / sizeof(bias[0]); k++) {
+        for (size_t i = 0; i < bias[k].n; i++) packed[bias[k].offset + i] = (model_default_t) bias[k].b[i];
+    }
+    for (size_t i = 0; i < N_WEIGHTS; i++) perturbed[i] = packed[i] * (model_default_t) 0.5 + (model_default_t) 0.01;
+
+    const size_t n_windows = sizeof(input) / sizeof(input[0]) / (N_TS * N1_LX);
+    std::vector<result_t> ref(n_windows * MODEL_OUT), out(n_windows * MODEL_OUT);
+    infer_batch(input, ref.data(), n_windows);
+    lstm(NULL, NULL, perturbed.data(), 1);
+    infer_batch(input, out.data(), n_windows);
+    bool changed = false;
+    for (size_t i = 0; i < out.size(); i++) changed |= out[i] != ref[i];
+    lstm(NULL, NULL, packed.data(), 1);
+    infer_batch(input, out.data(), n_windows);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < out.size(); i++) mismatches += out[i] != ref[i];
+    if (!changed || mismatches) {
+        printf("  %-34s FAIL: %s\n", name, !changed ? "the perturbed weights left the outputs unchanged" : "reloading the packed weights changed the outputs");
+        return false;
+    }
+    printf("  %-34s ok\n", name);
+    return true;
+}
+#endif
+
+// Build a window store from "sensor:file" inputs; the windows of each
+// file get times 0, 1, 2, ... in file order
+int pack_store(const std::string& store_file, int n_inputs, char* inputs[]) {
+    const size_t tensor_size = N_TS * N1_LX;
+    const size_t batch_windows = 4096;
+    std::vector<input_t> batch(batch_windows * tensor_size);
+
+    WindowStoreWriter store;
+    if (!store.open(store_file, tensor_size)) {
+        std::cerr << "Unable to open file: " << store_file << std::endl;
+        return 1;
+    }
+    for (int k = 0; k < n_inputs; k++) {
+        std::string arg = inputs[k];
+        size_t colon = arg.find(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Expected sensor:file, got " << arg << std::endl;
+            return 1;
+        }
+        uint32_t sensor = (uint32_t) strtoul(arg.substr(0, colon).c_str(), NULL, 10);
+        WindowReader reader(tensor_size);
+        reader.set_threads(0);
+        if (!reader.open(arg.substr(colon + 1))) {
+            std::cerr << "Unable to read " << arg.substr(colon + 1) << ": " << reader.error() << std::endl;
+            return 1;
+        }
+        uint64_t t = 0;
+        size_t n;
+        while ((n = reader.read(batch.data(), batch_windows)) > 0) {
+            for (size_t w = 0; w < n; w++) store.append(sensor, t++, &batch[w * tensor_size]);
+        }
+        std::cout << "sensor " << sensor << ": " << t << " windows\n";
+    }
+    if (!store.close()) {
+        std::cerr << "Error writing " << store_file << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Score every window of a raw sample series (N1_LX values per sample, one
+// sample per line or row), windows starting every stride samples
+int run_series_file(size_t stride, const std::string& input_file, const std::string& output_file) {
+    const size_t batch_windows = 4096;
+
+    WindowReader samples(N1_LX);
+    if (!samples.open(input_file)) {
+        std::cerr << "Unable to read " << input_file << ": " << samples.error() << std::endl;
+        return 1;
+    }
+    ResultWriter writer;
+    if (!writer.open(output_file)) {
+        std::cerr << "Unable to open file: " << output_file << std::endl;
+        return 1;
+    }
+    SeriesWindower windower(stride, batch_windows * stride + N_TS);
+    PipelineStats stats = run_series(samples, windower, writer, [](input_t* const* windows, result_t* out, size_t n) {
+        for (size_t w = 0; w < n; w++) infer_window(windows[w], &out[w * MODEL_OUT]);
+    }, batch_windows);
+
+    if (!writer.close()) {
+        std::cerr << "Error writing " << output_file << std::endl;
+        return 1;
+    }
+    std::cout << windower.samples() << " samples, stride " << stride << "\n";
+    stats.print();
+    return 0;
+}
+
 int main(int argc, char * argv[]) {
     std::cout << "# Starting Testbench \n";
 
+    // software_lstm_app --pack <store.lws> <sensor>:<input_file> ...: build a window store
+    if (argc > 3 && std::string(argv[1]) == "--pack") {
+        int ret = pack_store(argv[2], argc - 3, &argv[3]);
+        std::cout << "# End of Testbench \n";
+        return ret;
+    }
+
+    // software_lstm_app --check: the nnet_utils kernels against their
+    // references, the batch I/O against naive readers, and the allocations
+    // of steady-state inference
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        bool ok = layer_checks::run_all();
+        ok &= io_checks::run_all();
+        ok &= check_infer_allocations();
+#if RUNTIME_WEIGHTS
+        ok &= check_runtime_weights();
+#endif
+        std::cout << (ok ? "All checks passed\n" : "Checks FAILED\n");
+        std::cout << "# End of Testbench \n";
+        return ok ? 0 : 1;
+    }
+
+    // software_lstm_app --series <stride> <input_file> <output_file>: windows
+    // of a raw sample series
+    if (argc > 4 && std::string(argv[1]) == "--series") {
+        int ret = run_series_file(strtoul(argv[2], NULL, 10), argv[3], argv[4]);
+        std::cout << "# End of Testbench \n";
+        return ret;
+    }
+
+    // software_lstm_app <input_file> <output_file> [sensors [t_from [t_to]]]:
+    // batch run over a file; sensors ("all" or "3,7,12") and times select
+    // the windows of a .lws store
+    if (argc > 2) {
+        WindowQuery query;
+        query.parse(argc > 3 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL, argc > 5 ? argv[5] : NULL);
+        int ret = run_batch(argv[1], argv[2], query);
+        std::cout << "# End of Testbench \n";
+        return ret;
+    }
+
     const int BATCH = 1;
     input_t lstm_in[N_TS * N1_LX];
     result_t lstm_out[MODEL_OUT];
@@ -30,7 +303,7 @@ int main(int argc, char * argv[]) {
 
         TIMER_START(5);
         for (int r = 0; r < REPEAT; ++r) {
-            lstm(lstm_in, lstm_out);  // Call the LSTM function directly
+            infer_window(lstm_in, lstm_out);  // Call the LSTM function directly
         }
         TIMER_STOP;
 
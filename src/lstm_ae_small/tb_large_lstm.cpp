@@ -1,7 +1,6 @@
 #include <iomanip>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include "math.h"
@@ -9,49 +8,73 @@
 #include "HLS_AE_SMALL/input.h"
 #include "utils.h"
 #include "lstm_fpga.h"
+#include "window_parser.h"
+#include "result_writer.h"
+#include "window_store.h"
+#include "batch_pipeline.h"
 
 TIMER_INIT(6); //set number of timers to use
 
-
-void save_outputs_to_file(const std::vector<std::vector<result_t>>& outputs, const std::string& filename) {
-    std::ofstream out_file(filename);
-    for (size_t i = 0; i < outputs.size(); ++i) {
-        out_file << std::setw(5) << std::setfill('0') << i << ":";
-        for (size_t j = 0; j < outputs[i].size(); ++j) {
-            if (j != 0) {
-                out_file << ",";
-            }
-            out_file << outputs[i][j];
+// Sample series scored by the lstm_series kernel: the raw samples are sent
+// in chunks of up to SERIES_CHUNK and the windows are built on the device.
+// Each chunk starts at a window start; the samples after its last window
+// carry over into the next chunk.
+PipelineStats run_series_device(FPGA_LSTM* fpga, WindowReader& samples, size_t stride, ResultWriter& writer) {
+    typedef std::chrono::steady_clock clock;
+    stride = std::max<size_t>(stride, 1);
+    std::vector<input_t> chunk(SERIES_CHUNK * N1_LX);
+    std::vector<result_t> out(SERIES_MAX_WINDOWS * MODEL_OUT);
+    PipelineStats stats = {0, 0, {0, 0, 0}, 0};
+    const clock::time_point start = clock::now();
+
+    size_t have = 0;        // samples in chunk
+    size_t drop = 0;        // samples to skip before the next window (stride > N_TS)
+    uint64_t first = 0;     // sample number of chunk[0]
+    for (;;) {
+        clock::time_point t0 = clock::now();
+        size_t n = samples.read(&chunk[have * N1_LX], SERIES_CHUNK - have);
+        const size_t skip = std::min(drop, n);
+        if (skip) memmove(&chunk[have * N1_LX], &chunk[(have + skip) * N1_LX], (n - skip) * N1_LX * sizeof(input_t));
+        drop -= skip;
+        have += n - skip;
+        clock::time_point t1 = clock::now();
+        stats.busy_ms[0] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        if (have >= N_TS && (n == 0 || have == SERIES_CHUNK)) {
+            const int n_windows = fpga->run_series(chunk.data(), have, stride, out.data());
+            clock::time_point t2 = clock::now();
+            stats.busy_ms[1] += std::chrono::duration<double, std::milli>(t2 - t1).count();
+            for (int w = 0; w < n_windows; w++) writer.write(first + w * stride, &out[w * MODEL_OUT], MODEL_OUT);
+            stats.windows += n_windows;
+            stats.busy_ms[2] += std::chrono::duration<double, std::milli>(clock::now() - t2).count();
+
+            const size_t next = (size_t) n_windows * stride;   // start of the next window
+            const size_t keep = next < have ? have - next : 0;
+            memmove(&chunk[0], &chunk[(have - keep) * N1_LX], keep * N1_LX * sizeof(input_t));
+            drop = next - (have - keep);
+            first += next;
+            have = keep;
         }
-        out_file << std::endl;
-    }
-    out_file.close();
-}
-
-std::vector<input_t> parse_line_to_tensor(const std::string& line, size_t tensor_size) {
-    std::vector<input_t> data(tensor_size);
-    std::stringstream ss(line);
-    std::string index;
-    std::getline(ss, index, ':'); // Skip the index part
-
-    for (size_t i = 0; i < tensor_size; ++i) {
-        std::string value;
-        std::getline(ss, value, ',');
-        data[i] = std::stof(value);
+        if (n == 0) break;
     }
-
-    return data;
+    stats.total_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return stats;
 }
 
 int main(int argc, char * argv[]) {
     std::cout << "# Starting Testbench \n";
 
     const size_t tensor_size = N_TS * N1_LX; // Adjust this size based on your tensor dimensions
-    std::vector<input_t> lstm_in(tensor_size);
-    std::vector<result_t> lstm_out(MODEL_OUT);
+    const size_t batch_windows = 4096;       // windows per pipeline batch
+    // lstm_large_app <xclbin> <input_file> <output_file> [sensors [t_from [t_to]]]
+    // sensors ("all" or "3,7,12") and times select the windows of a .lws store
+    // lstm_large_app <xclbin> --series <stride> <input_file> <output_file>
+    // scores the windows of a raw sample series, a new one every stride samples
+    const bool series = argc > 5 && std::string(argv[2]) == "--series";
+    const size_t stride = series ? strtoul(argv[3], NULL, 10) : 0;
     std::string xclbinFilename = argv[1];
-    std::string input_file = argv[2];
-    std::string output_file = argv[3];
+    std::string input_file = argv[series ? 4 : 2];
+    std::string output_file = argv[series ? 5 : 3];
 
     printf("------------------------------------------------------\n");
     printf("  Starting FPGA LSTM...                \n");
@@ -62,37 +85,72 @@ int main(int argc, char * argv[]) {
     fpga->fpga_init(xclbinFilename);
     TIMER_STOP;
 
-    std::ifstream in_file(input_file);
-    if (!in_file) {
-        std::cerr << "Unable to open file: " << input_file << std::endl;
+    ResultWriter writer;
+    if (!writer.open(output_file)) {
+        std::cerr << "Unable to open file: " << output_file << std::endl;
         return 1;
     }
+    std::cout << "Write to file: " << output_file << std::endl;
 
-    std::vector<std::vector<result_t>> all_outputs;
-
-    std::string line;
-    int idx = 0;
-    while (std::getline(in_file, line)) {
-        lstm_in = parse_line_to_tensor(line, tensor_size);
-        std::cout << idx << std::endl;
-
-        std::fill(lstm_out.begin(), lstm_out.end(), 0);
-
-        TIMER_START(5);
-        fpga->run(lstm_in.data(), lstm_out.data());
-        TIMER_STOP;
-
-        printf("------------------------------------------------------\n");
-
-        all_outputs.push_back(lstm_out);
-
-        idx++;
+    // read/parse, FPGA and write-out overlap on separate threads; the FPGA
+    // is only driven from this thread
+    auto infer = [&](input_t* in, result_t* out, size_t n) {
+        for (size_t w = 0; w < n; w++) {
+            TIMER_START(5);
+            fpga->run(&in[w * tensor_size], &out[w * MODEL_OUT]);
+            TIMER_STOP_ID(5);   // run() starts and stops timer 3 in between
+        }
+    };
+
+    PipelineStats stats;
+    if (series) {
+        WindowReader samples(N1_LX);
+        if (!samples.open(input_file)) {
+            std::cerr << "Unable to read " << input_file << ": " << samples.error() << std::endl;
+            return 1;
+        }
+        if (fpga->has_series()) {
+            // windows built on the device from the raw samples
+            stats = run_series_device(fpga, samples, stride, writer);
+        } else {
+            // windows built on the host, sent in full
+            SeriesWindower windower(stride, batch_windows * stride + N_TS);
+            stats = run_series(samples, windower, writer, [&](input_t* const* windows, result_t* out, size_t n) {
+                for (size_t w = 0; w < n; w++) infer(windows[w], &out[w * MODEL_OUT], 1);
+            }, batch_windows);
+        }
+        std::cout << "stride " << stride << (fpga->has_series() ? ", windows built on the device" : "") << std::endl;
+    } else if (path_ends_with(input_file, ".lws")) {
+        // window store: replay the selected sensors/times only
+        WindowQuery query;
+        query.parse(argc > 4 ? argv[4] : NULL, argc > 5 ? argv[5] : NULL, argc > 6 ? argv[6] : NULL);
+        WindowStore store;
+        if (!store.open(input_file) || store.tensor_size() != tensor_size) {
+            std::cerr << "Unable to read " << input_file << ": " << (store.error().empty() ? "window size does not match the model input" : store.error()) << std::endl;
+            return 1;
+        }
+        store.query(query);
+        std::cout << store.selected_chunks() << " of " << store.chunks().size() << " chunks selected" << std::endl;
+        stats = run_pipeline(store, writer, infer, batch_windows);
+    } else {
+        WindowReader reader(tensor_size);
+        reader.set_threads(0);   // text is parsed on all cores
+        if (!reader.open(input_file)) {
+            std::cerr << "Unable to read " << input_file << ": " << reader.error() << std::endl;
+            return 1;
+        }
+        stats = run_pipeline(reader, writer, infer, batch_windows);
+        if (reader.errors()) {
+            std::cerr << reader.errors() << " malformed input lines, missing values set to 0" << std::endl;
+        }
+    }
+    if (!writer.close()) {
+        std::cerr << "Error writing " << output_file << std::endl;
     }
-    std::cout << "Write to file: " << output_file << std::endl;
-    save_outputs_to_file(all_outputs, output_file);
 
     std::cout << "# End of Testbench \n";
 
+    stats.print();
     fpga->print_performance_report();
 
     delete fpga;
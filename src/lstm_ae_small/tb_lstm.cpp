@@ -31,6 +31,20 @@ int REPEAT = atoi(argv[2]);
   fpga -> fpga_init(xclbinFilename);
   TIMER_STOP;
 
+#if RUNTIME_WEIGHTS
+  // optional packed weight file: N_WEIGHTS raw model_default_t values
+  if (argc > 3) {
+    std::vector<model_default_t> weights(N_WEIGHTS);
+    std::ifstream weights_file(argv[3], std::ios::binary);
+    weights_file.read((char *) weights.data(), sizeof(model_default_t) * N_WEIGHTS);
+    if (!weights_file) {
+      std::cerr << "Unable to read " << N_WEIGHTS << " weights from: " << argv[3] << std::endl;
+      return 1;
+    }
+    fpga -> load_weights(weights.data());
+  }
+#endif
+
 
     for (int k = 0; k < BATCH; k++) {
     	std::cout <<"\n input ";
@@ -94,10 +94,6 @@ endif
 device2xsa = $(strip $(patsubst %.xpfm, % , $(shell basename $(DEVICE))))
 
 ############################## Deprecated Checks and Running Rules ##############################
-check:
-	$(ECHO) "WARNING: \"make check\" is a deprecated command. Please use \"make run\" instead"
-	make run
-
 exe:
 	$(ECHO) "WARNING: \"make exe\" is a deprecated command. Please use \"make host\" instead"
 	make host
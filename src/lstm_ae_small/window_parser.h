@@ -0,0 +1,465 @@
+#pragma once
+
+// Reader for the batch testbench input files: text, one window per line
+// ("index:v0,v1,...,vN-1"), or one of the binary formats of batch_format.h.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define WINDOW_READER_MMAP
+#endif
+
+#include "parameters.h"
+#include "batch_format.h"
+#include "alloc_counter.h"
+
+// Parse one decimal float starting at p, return the first character after
+// it (p itself if there is no number). The text must be followed by a
+// non-numeric character or '\0' before end.
+inline const char* parse_float(const char* p, const char* end, float& v) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    if (p < end && *p == '+') p++;
+    std::from_chars_result r = std::from_chars(p, end, v);
+    if (r.ec == std::errc()) return r.ptr;
+#else
+    // Exact fast path for short decimals: a mantissa below 2^24 and a power
+    // of ten up to 1e10 are exact floats, so one IEEE multiply/divide gives
+    // the correctly rounded result, the same as strtof.
+    static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    const char* q = p;
+    bool neg = false;
+    if (q < end && (*q == '-' || *q == '+')) neg = (*q++ == '-');
+    uint32_t m = 0;
+    int digits = 0, exp10 = 0;
+    while (q < end && (unsigned)(*q - '0') < 10 && digits < 8) { m = m * 10 + (*q++ - '0'); digits += (m != 0); }
+    if (q < end && *q == '.') {
+        q++;
+        while (q < end && (unsigned)(*q - '0') < 10 && digits < 8) { m = m * 10 + (*q++ - '0'); digits += (m != 0); exp10--; }
+    }
+    bool simple = q > p && (unsigned)(q[-1] - '0') < 10 && m <= (1u << 24);
+    if (simple && q < end && (*q == 'e' || *q == 'E')) {
+        const char* e = q + 1;
+        bool eneg = false;
+        if (e < end && (*e == '-' || *e == '+')) eneg = (*e++ == '-');
+        int x = 0, n = 0;
+        while (e < end && (unsigned)(*e - '0') < 10 && n < 4) { x = x * 10 + (*e++ - '0'); n++; }
+        simple = n > 0;
+        exp10 += eneg ? -x : x;
+        q = e;
+    }
+    if (simple && (q >= end || (unsigned)(*q - '0') >= 10) && exp10 >= -10 && exp10 <= 10) {
+        float f = (float) m;
+        f = exp10 < 0 ? f / pow10[-exp10] : f * pow10[exp10];
+        v = neg ? -f : f;
+        return q;
+    }
+#endif
+    char* r_end;
+    v = strtof(p, &r_end);
+    return r_end;
+}
+
+// Reads the windows of a file and parses them in place into caller-provided
+// batch arrays: no per-line or per-value allocations. Lines with missing or
+// malformed values are zero-filled and counted in errors().
+//
+// Regular files are memory-mapped and parsed straight from the page cache,
+// with sequential/readahead hints a few blocks ahead of the parser, so a
+// cold replay streams at disk bandwidth with no read() copies. Anything
+// that can not be mapped (pipes, or use_mmap = false) is read in large
+// blocks into one buffer instead.
+//
+// Text can be parsed on several threads (set_threads). Each read() takes
+// about max_windows lines worth of bytes (from the line length seen so
+// far) and splits them into one byte range per thread; every thread moves
+// its range to line boundaries itself and parses its lines, the first
+// straight into the batch, the others into their own buffer that is then
+// copied in after it, so the windows keep the file order.
+class WindowReader {
+  public:
+    explicit WindowReader(size_t tensor_size, size_t buffer_bytes = 16 << 20, bool use_mmap = true)
+        : m_tensor_size(tensor_size), m_use_mmap(use_mmap), m_file(NULL),
+          m_map(NULL), m_map_size(0), m_advised(0),
+          m_buf(std::max(buffer_bytes, 4 * tensor_size) + 1), m_data(&m_buf[0]),
+          m_begin(0), m_end(0), m_eof(false), m_line_bytes(0), m_errors(0),
+          m_chunks(1), m_generation(0), m_pending(0), m_stop(false) {
+        m_fmt.format = FORMAT_TEXT;
+        m_fmt.npy = false;
+    }
+    ~WindowReader() {
+        stop_workers();
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+        m_file = fopen(path.c_str(), "rb");
+        m_errors = 0;
+        m_error_msg.clear();
+        if (!m_file) { m_error_msg = "unable to open file"; return false; }
+        m_fmt = batch_file_from_path(path);
+        if (m_fmt.npy) {
+            size_t row_size;
+            if (!npy_read_header(m_file, m_fmt.format, row_size, m_error_msg)) return false;
+            if (row_size != 0 && row_size != m_tensor_size) {
+                m_error_msg = "row size " + std::to_string(row_size) + " does not match the model input " + std::to_string(m_tensor_size);
+                return false;
+            }
+        }
+        if (!(m_use_mmap && map(ftell(m_file)))) {
+#ifdef WINDOW_READER_MMAP
+            posix_fadvise(fileno(m_file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef WINDOW_READER_MMAP
+        if (m_map) munmap(m_map, m_map_size);
+#endif
+        m_map = NULL;
+        m_map_size = 0;
+        if (m_file) fclose(m_file);
+        m_file = NULL;
+        m_data = &m_buf[0];
+        m_begin = m_end = 0;
+        m_eof = false;
+    }
+
+    // Why open() failed
+    const std::string& error() const { return m_error_msg; }
+
+    // Whether the file is parsed from a memory mapping
+    bool mapped() const { return m_map != NULL; }
+
+    // Parse text on up to n threads: the caller plus n - 1 workers, started
+    // here and kept for every read; 0 picks the number of cores
+    void set_threads(unsigned n) {
+        if (n == 0) n = std::thread::hardware_concurrency();
+        n = std::max(1u, n);
+        stop_workers();
+        m_chunks.resize(n);
+        m_stop = false;
+        for (unsigned t = 1; t < n; t++) m_workers.push_back(std::thread(&WindowReader::worker, this, t));
+    }
+
+    // Parse up to max_windows windows into batch[max_windows * tensor_size].
+    // Returns the number of windows read, 0 at the end of the file.
+    size_t read(input_t* batch, size_t max_windows) {
+        if (m_fmt.format != FORMAT_TEXT) return read_binary(batch, max_windows);
+
+        if (max_windows == 0) return 0;
+
+        for (;;) {
+            if (m_line_bytes == 0) m_line_bytes = 16 * m_tensor_size;   // first guess, corrected per read
+            const size_t want = max_windows * m_line_bytes;
+            if (!m_eof && m_end - m_begin < want) fill();
+
+            // End the region after the last newline within want bytes, or
+            // after the first one beyond them for a line longer than that
+            const char* base = &m_data[m_begin];
+            const size_t avail = m_end - m_begin;
+            const size_t span = std::min(want, avail);
+            size_t region = span;
+            while (region > 0 && base[region - 1] != '\n') region--;
+            if (region == 0 && span < avail) {
+                const char* nl = (const char*) memchr(base + span, '\n', avail - span);
+                if (nl) region = nl + 1 - base;
+            }
+            if (region == 0) {
+                if (!m_eof) { fill(); continue; }
+                if (avail == 0) { advise(); return 0; }
+                // last line without a newline: parse a terminated copy, the
+                // mapping has no '\0' after it
+                m_tail.assign(base, avail);
+                if (!m_tail.empty() && m_tail[m_tail.size() - 1] == '\r') m_tail.resize(m_tail.size() - 1);
+                m_begin = m_end;
+                if (m_tail.empty()) continue;
+                if (!parse_line(m_tail.c_str(), m_tail.c_str() + m_tail.size(), batch)) m_errors++;
+                advise();
+                return 1;
+            }
+
+            const size_t first = m_begin;
+            const size_t n = parse_region(batch, max_windows, m_begin, m_begin + region);
+            advise();
+            if (n > 0) {
+                m_line_bytes = std::max<size_t>(1, (m_begin - first) / n);
+                return n;
+            }
+        }
+    }
+
+    size_t errors() const { return m_errors; }
+
+  private:
+    size_t read_binary(input_t* batch, size_t max_windows) {
+        const size_t elem = batch_elem_size(m_fmt.format);
+        const size_t window_bytes = elem * m_tensor_size;
+        if (m_map) {
+            size_t n = std::min(max_windows, (m_end - m_begin) / window_bytes);
+            convert(&m_data[m_begin], n * m_tensor_size, batch);
+            m_begin += n * window_bytes;
+            advise();
+            return n;
+        }
+        if (m_fmt.format == FORMAT_F32 && std::is_same<input_t, float>::value) {
+            return fread(batch, window_bytes, max_windows, m_file);
+        }
+        size_t n = 0;
+        while (n < max_windows) {
+            size_t want = std::min(max_windows - n, (m_buf.size() - 1) / window_bytes);
+            size_t got = fread(&m_buf[0], window_bytes, want, m_file);
+            convert(&m_buf[0], got * m_tensor_size, &batch[n * m_tensor_size]);
+            n += got;
+            if (got < want) break;
+        }
+        return n;
+    }
+
+    void convert(const char* src, size_t count, input_t* out) {
+        for (size_t i = 0; i < count; i++) {
+            float v;
+            if (m_fmt.format == FORMAT_F16) {
+                uint16_t h;
+                memcpy(&h, &src[i * 2], 2);
+                v = half_to_float(h);
+            } else {
+                memcpy(&v, &src[i * 4], 4);
+            }
+            out[i] = (input_t) v;
+        }
+    }
+
+    // Map the whole file, data from offset on
+    bool map(long offset) {
+#ifdef WINDOW_READER_MMAP
+        struct stat st;
+        int fd = fileno(m_file);
+        if (offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= offset) return false;
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return false;
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        m_map = p;
+        m_map_size = st.st_size;
+        m_data = (const char*) p;
+        m_begin = offset;
+        m_end = st.st_size;
+        m_eof = true;
+        m_advised = offset;
+        advise();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Keep readahead_bytes of the mapping ahead of the parser requested
+    void advise() {
+#ifdef WINDOW_READER_MMAP
+        static const size_t page = 4096;
+        static const size_t readahead_bytes = 64 << 20;
+        if (!m_map || m_advised >= m_end || m_advised > m_begin + readahead_bytes / 2) return;
+        size_t from = m_advised & ~(page - 1);
+        size_t to = std::min(m_end, m_begin + readahead_bytes);
+        madvise((char*) m_map + from, to - from, MADV_WILLNEED);
+        m_advised = to;
+#endif
+    }
+
+    // Buffered mode: move the partial line to the front of the buffer and
+    // read the next block
+    void fill() {
+        size_t rest = m_end - m_begin;
+        if (rest == m_buf.size() - 1) m_buf.resize(2 * m_buf.size());   // line longer than the buffer
+        memmove(&m_buf[0], &m_buf[m_begin], rest);
+        m_data = &m_buf[0];
+        m_begin = 0;
+        m_end = rest + fread(&m_buf[rest], 1, m_buf.size() - 1 - rest, m_file);
+        m_buf[m_end] = '\0';
+        if (m_end == rest) m_eof = true;
+    }
+
+    // Parse the lines of [begin, end) (which ends on a newline) into the
+    // first max_windows slots of batch, on up to one thread per 256 lines,
+    // and move m_begin past the lines taken. Returns their number.
+    size_t parse_region(input_t* batch, size_t max_windows, size_t begin, size_t end) {
+        const size_t min_bytes = 256 * m_line_bytes;   // per thread, below that a thread costs more than it saves
+        const size_t n_threads = std::min<size_t>(m_chunks.size(), std::max<size_t>(1, (end - begin) / min_bytes));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job.batch = batch;
+            m_job.max_windows = max_windows;
+            m_job.begin = begin;
+            m_job.end = end;
+            m_job.threads = n_threads;
+            if (n_threads > 1) {
+                m_pending = n_threads - 1;
+                m_generation++;
+            }
+        }
+        if (n_threads > 1) m_wake.notify_all();
+        parse_range(0);
+        if (n_threads > 1) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this] { return m_pending == 0; });
+        }
+
+        // Chunks in range order, up to max_windows lines
+        size_t n = 0;
+        size_t consumed = begin;
+        bool full = false;
+        for (size_t t = 0; t < n_threads && !full; t++) {
+            const ParseChunk& c = m_chunks[t];
+            const size_t take = std::min(c.n, max_windows - n);
+            if (t > 0) std::copy(c.values.begin(), c.values.begin() + take * m_tensor_size, &batch[n * m_tensor_size]);
+            for (size_t i = 0; i < take; i++) m_errors += !c.ok[i];
+            if (take > 0) consumed = c.next[take - 1];
+            n += take;
+            full = take < c.n || !c.complete;
+        }
+        m_begin = full ? consumed : end;
+        return n;
+    }
+
+    // Parse the lines starting in range t of the current job: the first
+    // thread into the batch, the others into their chunk
+    void parse_range(size_t t) {
+        const size_t span = m_job.end - m_job.begin;
+        size_t p = line_start(m_job.begin + t * span / m_job.threads);
+        const size_t last = line_start(m_job.begin + (t + 1) * span / m_job.threads);
+        ParseChunk& c = m_chunks[t];
+        c.n = 0;
+        while (p < last && c.n < m_job.max_windows) {
+            const char* line = &m_data[p];
+            const char* nl = (const char*) memchr(line, '\n', last - p);
+            const char* stop = nl > line && nl[-1] == '\r' ? nl - 1 : nl;
+            p = nl + 1 - m_data;
+            if (stop == line) continue;
+            if (c.n == c.next.size()) {
+                const size_t cap = std::max<size_t>(64, 2 * c.n);
+                c.next.resize(cap);
+                c.ok.resize(cap);
+                if (t > 0) c.values.resize(cap * m_tensor_size);
+            }
+            input_t* out = t > 0 ? &c.values[c.n * m_tensor_size] : &m_job.batch[c.n * m_tensor_size];
+            c.ok[c.n] = parse_line(line, stop, out);
+            c.next[c.n] = p;
+            c.n++;
+        }
+        c.complete = p >= last;
+    }
+
+    // Start of the first line at or after pos within the current job
+    size_t line_start(size_t pos) const {
+        if (pos <= m_job.begin) return m_job.begin;
+        if (pos >= m_job.end) return m_job.end;
+        const char* nl = (const char*) memchr(&m_data[pos - 1], '\n', m_job.end - (pos - 1));
+        return nl + 1 - m_data;
+    }
+
+    // Parse worker t: waits for a job, parses its range if the job uses it
+    void worker(size_t t) {
+        alloc_count_exclude_thread();   // an I/O thread, see batch_pipeline.h
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop) return;
+                seen = m_generation;
+                if (t >= m_job.threads) continue;
+            }
+            parse_range(t);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) m_done.notify_one();
+        }
+    }
+
+    void stop_workers() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (size_t t = 0; t < m_workers.size(); t++) m_workers[t].join();
+        m_workers.clear();
+    }
+
+    // Returns false if a value is missing or malformed
+    bool parse_line(const char* p, const char* end, input_t* out) const {
+        const char* colon = (const char*) memchr(p, ':', end - p);
+        if (colon) p = colon + 1;   // skip the index
+        bool ok = true;
+        for (size_t i = 0; i < m_tensor_size; i++) {
+            float v = 0;
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+            const char* q = p < end ? parse_float(p, end, v) : p;
+            if (q == p) { ok = false; v = 0; }
+            out[i] = (input_t) v;
+            p = q;
+            if (p < end && *p == ',') p++;
+        }
+        return ok;
+    }
+
+    size_t m_tensor_size;
+    bool m_use_mmap;
+    FILE* m_file;
+    BatchFile m_fmt;
+    std::string m_error_msg;
+    void* m_map;
+    size_t m_map_size;
+    size_t m_advised;          // mapping requested up to here
+    std::vector<char> m_buf;
+    const char* m_data;        // m_buf or the mapping
+    size_t m_begin, m_end;     // unparsed part of m_data
+    bool m_eof;
+    size_t m_line_bytes;       // average bytes per window of the last read
+    std::string m_tail;
+    size_t m_errors;
+
+    // One parse job: the lines of [begin, end) split over threads ranges
+    struct ParseJob {
+        input_t* batch;
+        size_t max_windows;
+        size_t begin, end;
+        size_t threads;
+    };
+    // The windows one thread parsed; values unused by the first thread,
+    // which writes to the batch
+    struct ParseChunk {
+        std::vector<input_t> values;
+        std::vector<size_t> next;   // offset after each line
+        std::vector<char> ok;
+        size_t n;
+        bool complete;              // all lines of the range parsed
+        ParseChunk() : n(0), complete(true) {}
+    };
+    ParseJob m_job;
+    std::vector<ParseChunk> m_chunks;   // one per thread
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    uint64_t m_generation;     // bumped per job that uses the workers
+    size_t m_pending;          // workers still parsing the current job
+    bool m_stop;
+};
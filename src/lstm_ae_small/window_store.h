@@ -0,0 +1,349 @@
+#pragma once
+
+// Window store (.lws): windows of many sensors in one file, for replays
+// that only need some sensors or time ranges. Windows are grouped into
+// chunks of one sensor in time order; a chunk is stored by column (the
+// times, then element 0 of every window, element 1, ...), optionally
+// deflated, and an index at the end of the file gives the sensor, time
+// range and location of every chunk. A query reads the index only, and
+// then just the chunks it selects, from a memory mapping.
+//
+//   header  "LSTMWS1\0", u32 tensor_size, u32 reserved,
+//           u64 n_chunks, u64 index offset
+//   chunks  u64 time[n], f32 value[tensor_size][n]   (raw or deflated)
+//   index   ChunkEntry[n_chunks]
+//
+// Little-endian, like the binary formats of batch_format.h. Compression
+// needs zlib (WINDOW_STORE_ZLIB); a build without it can still read the
+// uncompressed chunks.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#ifdef WINDOW_STORE_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define WINDOW_STORE_MMAP
+#endif
+
+#include "parameters.h"
+
+struct WindowStoreHeader {
+    char magic[8];
+    uint32_t tensor_size;
+    uint32_t reserved;
+    uint64_t n_chunks;
+    uint64_t index_offset;
+};
+
+struct ChunkEntry {
+    uint32_t sensor;
+    uint32_t n;                 // windows
+    uint64_t t_first, t_last;   // time of the first and last window
+    uint64_t offset;
+    uint64_t stored_bytes;
+    uint32_t compressed;        // 1: stored_bytes of deflate stream
+    uint32_t reserved;
+};
+
+static const char window_store_magic[8] = {'L', 'S', 'T', 'M', 'W', 'S', '1', '\0'};
+
+// Windows to replay: some or all sensors, times in [t_from, t_to]
+struct WindowQuery {
+    std::vector<uint32_t> sensors;   // sorted, empty for all
+    uint64_t t_from, t_to;
+
+    WindowQuery() : t_from(0), t_to(UINT64_MAX) {}
+
+    bool has_sensor(uint32_t s) const {
+        return sensors.empty() || std::binary_search(sensors.begin(), sensors.end(), s);
+    }
+    bool selects(const ChunkEntry& c) const {
+        return has_sensor(c.sensor) && c.t_last >= t_from && c.t_first <= t_to;
+    }
+
+    // From the command line: "all" or "3,7,12", then the optional time range
+    void parse(const char* sensor_list, const char* from, const char* to) {
+        sensors.clear();
+        if (sensor_list && strcmp(sensor_list, "all") != 0) {
+            const char* p = sensor_list;
+            while (*p) {
+                char* end;
+                unsigned long s = strtoul(p, &end, 10);
+                if (end == p) { p++; continue; }
+                sensors.push_back((uint32_t) s);
+                p = end;
+            }
+            std::sort(sensors.begin(), sensors.end());
+        }
+        if (from) t_from = strtoull(from, NULL, 10);
+        if (to) t_to = strtoull(to, NULL, 10);
+    }
+};
+
+// Builds a store: windows are appended per sensor and written out a
+// chunk at a time (sorted by time), so memory is one chunk per sensor.
+class WindowStoreWriter {
+  public:
+    explicit WindowStoreWriter(size_t chunk_windows = 4096, bool compress = true)
+        : m_chunk_windows(chunk_windows), m_compress(compress), m_file(NULL), m_tensor_size(0), m_error(false) {}
+    ~WindowStoreWriter() { close(); }
+
+    bool open(const std::string& path, size_t tensor_size) {
+        close();
+        m_file = fopen(path.c_str(), "wb");
+        if (!m_file) return false;
+        m_tensor_size = tensor_size;
+        m_index.clear();
+        m_error = false;
+        WindowStoreHeader h;
+        memset(&h, 0, sizeof(h));
+        m_error = fwrite(&h, sizeof(h), 1, m_file) != 1;   // rewritten by close()
+        return !m_error;
+    }
+
+    void append(uint32_t sensor, uint64_t time, const input_t* window) {
+        Pending& p = m_pending[sensor];
+        p.times.push_back(time);
+        for (size_t i = 0; i < m_tensor_size; i++) p.values.push_back((float) window[i]);
+        if (p.times.size() == m_chunk_windows) flush(sensor, p);
+    }
+
+    // Write the partial chunks and the index. Returns false if any write failed.
+    bool close() {
+        if (!m_file) return !m_error;
+        for (std::map<uint32_t, Pending>::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+            if (!it->second.times.empty()) flush(it->first, it->second);
+        }
+        m_pending.clear();
+        WindowStoreHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, window_store_magic, sizeof(h.magic));
+        h.tensor_size = (uint32_t) m_tensor_size;
+        h.n_chunks = m_index.size();
+        h.index_offset = ftell(m_file);
+        if (!m_index.empty() && fwrite(&m_index[0], sizeof(ChunkEntry), m_index.size(), m_file) != m_index.size()) m_error = true;
+        if (fseek(m_file, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, m_file) != 1) m_error = true;
+        if (fclose(m_file) != 0) m_error = true;
+        m_file = NULL;
+        return !m_error;
+    }
+
+  private:
+    struct Pending {
+        std::vector<uint64_t> times;
+        std::vector<float> values;   // row-major while collecting
+    };
+
+    void flush(uint32_t sensor, Pending& p) {
+        const size_t n = p.times.size();
+        // readers rely on time order within a chunk
+        m_order.resize(n);
+        for (size_t w = 0; w < n; w++) m_order[w] = w;
+        if (!std::is_sorted(p.times.begin(), p.times.end())) {
+            std::stable_sort(m_order.begin(), m_order.end(), [&p](size_t a, size_t b) { return p.times[a] < p.times[b]; });
+        }
+        // columns: the times, then one column per window element
+        m_raw.resize(n * sizeof(uint64_t) + n * m_tensor_size * sizeof(float));
+        uint64_t* times = (uint64_t*) &m_raw[0];
+        float* col = (float*) &m_raw[n * sizeof(uint64_t)];
+        for (size_t w = 0; w < n; w++) {
+            const size_t src = m_order[w];
+            times[w] = p.times[src];
+            for (size_t i = 0; i < m_tensor_size; i++) col[i * n + w] = p.values[src * m_tensor_size + i];
+        }
+
+        ChunkEntry c;
+        memset(&c, 0, sizeof(c));
+        c.sensor = sensor;
+        c.n = (uint32_t) n;
+        c.t_first = times[0];
+        c.t_last = times[n - 1];
+        c.offset = ftell(m_file);
+        const char* data = &m_raw[0];
+        c.stored_bytes = m_raw.size();
+#ifdef WINDOW_STORE_ZLIB
+        if (m_compress) {
+            uLongf len = compressBound(m_raw.size());
+            m_packed.resize(len);
+            // kept only if it saves something
+            if (compress2((Bytef*) &m_packed[0], &len, (const Bytef*) &m_raw[0], m_raw.size(), Z_DEFAULT_COMPRESSION) == Z_OK &&
+                len < m_raw.size()) {
+                data = &m_packed[0];
+                c.stored_bytes = len;
+                c.compressed = 1;
+            }
+        }
+#endif
+        if (fwrite(data, 1, c.stored_bytes, m_file) != c.stored_bytes) m_error = true;
+        m_index.push_back(c);
+        p.times.clear();
+        p.values.clear();
+    }
+
+    size_t m_chunk_windows;
+    bool m_compress;
+    FILE* m_file;
+    size_t m_tensor_size;
+    std::map<uint32_t, Pending> m_pending;
+    std::vector<ChunkEntry> m_index;
+    std::vector<size_t> m_order;
+    std::vector<char> m_raw, m_packed;
+    bool m_error;
+};
+
+// Reads the windows a WindowQuery selects, a batch at a time, in file
+// order. Only the index and the selected chunks are touched.
+class WindowStore {
+  public:
+    WindowStore() : m_file(NULL), m_map(NULL), m_map_size(0), m_tensor_size(0), m_next_chunk(0), m_sensor(0), m_pos(0), m_n(0) {}
+    ~WindowStore() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        m_error_msg.clear();
+        m_file = fopen(path.c_str(), "rb");
+        if (!m_file) { m_error_msg = "unable to open file"; return false; }
+        WindowStoreHeader h;
+        if (fread(&h, sizeof(h), 1, m_file) != 1 || memcmp(h.magic, window_store_magic, sizeof(h.magic)) != 0) {
+            m_error_msg = "not a window store";
+            return false;
+        }
+        m_tensor_size = h.tensor_size;
+        m_index.resize(h.n_chunks);
+        if (fseek(m_file, (long) h.index_offset, SEEK_SET) != 0 ||
+            (h.n_chunks && fread(&m_index[0], sizeof(ChunkEntry), h.n_chunks, m_file) != h.n_chunks)) {
+            m_error_msg = "truncated index";
+            return false;
+        }
+#ifdef WINDOW_STORE_MMAP
+        struct stat st;
+        if (fstat(fileno(m_file), &st) == 0 && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(m_file), 0);
+            if (p != MAP_FAILED) {
+                m_map = p;
+                m_map_size = st.st_size;
+            }
+        }
+#endif
+        query(WindowQuery());
+        return true;
+    }
+
+    void close() {
+#ifdef WINDOW_STORE_MMAP
+        if (m_map) munmap(m_map, m_map_size);
+#endif
+        m_map = NULL;
+        m_map_size = 0;
+        if (m_file) fclose(m_file);
+        m_file = NULL;
+    }
+
+    const std::string& error() const { return m_error_msg; }
+    size_t tensor_size() const { return m_tensor_size; }
+    const std::vector<ChunkEntry>& chunks() const { return m_index; }
+
+    // Start reading the windows selected by q
+    void query(const WindowQuery& q) {
+        m_query = q;
+        m_selected.clear();
+        for (size_t i = 0; i < m_index.size(); i++) {
+            if (q.selects(m_index[i])) m_selected.push_back(i);
+        }
+        m_next_chunk = 0;
+        m_pos = m_n = 0;
+    }
+
+    // Number of chunks the current query reads, of chunks().size()
+    size_t selected_chunks() const { return m_selected.size(); }
+
+    // Copy up to max_windows selected windows to batch[max_windows *
+    // tensor_size], their times to index and their sensors to sensor.
+    // Returns 0 when done.
+    size_t read(input_t* batch, size_t max_windows, uint64_t* index, uint32_t* sensor) {
+        size_t n = 0;
+        while (n < max_windows) {
+            if (m_pos == m_n && !next_chunk()) break;
+            const uint64_t t = m_times[m_pos];
+            if (t > m_query.t_to) { m_pos = m_n; continue; }   // rest of the chunk is later
+            if (t >= m_query.t_from) {
+                for (size_t i = 0; i < m_tensor_size; i++) batch[n * m_tensor_size + i] = (input_t) m_cols[i * m_n + m_pos];
+                sensor[n] = m_sensor;
+                index[n++] = t;
+            }
+            m_pos++;
+        }
+        return n;
+    }
+
+  private:
+    bool next_chunk() {
+        while (m_next_chunk < m_selected.size()) {
+            const ChunkEntry& c = m_index[m_selected[m_next_chunk++]];
+            if (load(c)) return true;
+            fprintf(stderr, "window store: skipping unreadable chunk at offset %llu\n", (unsigned long long) c.offset);
+        }
+        return false;
+    }
+
+    bool load(const ChunkEntry& c) {
+        const size_t raw_bytes = c.n * (sizeof(uint64_t) + m_tensor_size * sizeof(float));
+        const char* stored;
+        if (m_map) {
+            if (c.offset + c.stored_bytes > m_map_size) return false;
+            stored = (const char*) m_map + c.offset;
+        } else {
+            m_stored.resize(c.stored_bytes);
+            if (fseek(m_file, (long) c.offset, SEEK_SET) != 0 || fread(&m_stored[0], 1, c.stored_bytes, m_file) != c.stored_bytes) return false;
+            stored = &m_stored[0];
+        }
+        const char* raw = stored;
+        if (c.compressed) {
+#ifdef WINDOW_STORE_ZLIB
+            m_raw.resize(raw_bytes);
+            uLongf len = raw_bytes;
+            if (uncompress((Bytef*) &m_raw[0], &len, (const Bytef*) stored, c.stored_bytes) != Z_OK || len != raw_bytes) return false;
+            raw = &m_raw[0];
+#else
+            return false;   // built without zlib
+#endif
+        } else if (c.stored_bytes != raw_bytes) {
+            return false;
+        }
+        m_times.resize(c.n);
+        m_cols.resize(c.n * m_tensor_size);
+        memcpy(&m_times[0], raw, c.n * sizeof(uint64_t));
+        memcpy(&m_cols[0], raw + c.n * sizeof(uint64_t), c.n * m_tensor_size * sizeof(float));
+        m_n = c.n;
+        m_sensor = c.sensor;
+        // chunks are in time order: start at the first window of the range
+        m_pos = std::lower_bound(m_times.begin(), m_times.end(), m_query.t_from) - m_times.begin();
+        return true;
+    }
+
+    FILE* m_file;
+    void* m_map;
+    size_t m_map_size;
+    std::string m_error_msg;
+    size_t m_tensor_size;
+    std::vector<ChunkEntry> m_index;
+    WindowQuery m_query;
+    std::vector<size_t> m_selected;   // chunks of the query
+    size_t m_next_chunk;
+    std::vector<char> m_stored, m_raw;
+    std::vector<uint64_t> m_times;    // current chunk
+    std::vector<float> m_cols;
+    uint32_t m_sensor;
+    size_t m_pos, m_n;
+};
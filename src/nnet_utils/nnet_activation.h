@@ -21,6 +21,9 @@
 #define NNET_ACTIVATION_H_
 
 #include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <utility>
 #include "ap_fixed.h"
 #include "nnet_common.h"
 #include "hls_math.h"
@@ -35,6 +38,10 @@ struct activ_config
 
     // Internal info
     static const unsigned table_size = 1024;
+    static const unsigned interp_table_size = 64;
+
+    // Sigmoid/tanh implementation, see activ_impl_type
+    static const unsigned activ_impl = activ_lut;
 
     // Resource reuse info
     static const unsigned io_type = io_parallel;
@@ -117,6 +124,198 @@ void  relu1(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
     relu_max<data_T, res_T, 1, CONFIG_T>(data, res);
 }
 
+// *************************************************
+//       Compile-time tables
+// *************************************************
+// constexpr exp: exp(x) = exp(x/2^k)^(2^k) with |x/2^k| <= 1/2 and a
+// Taylor series, double accurate over the table ranges
+constexpr double exp_constexpr(double x)
+{
+    int k = 0;
+    while (x > 0.5 || x < -0.5) {
+        x /= 2;
+        k++;
+    }
+    double term = 1, sum = 1;
+    for (int n = 1; n < 20; n++) {
+        term *= x / n;
+        sum += term;
+    }
+    for (int i = 0; i < k; i++) {
+        sum *= sum;
+    }
+    return sum;
+}
+
+struct sigmoid_constexpr {
+    static constexpr double value(double x) { return 1.0 / (1.0 + exp_constexpr(-x)); }
+};
+
+struct tanh_constexpr {
+    static constexpr double value(double x) { return 1.0 - 2.0 / (exp_constexpr(2.0 * x) + 1.0); }
+};
+
+template<class table_T, int N_TABLE>
+struct table_array {
+    table_T data[N_TABLE];
+};
+
+// N_TABLE entries of FN over [-2^R, 2^R), entry ii at 2^(R+1)*(ii-N/2)/N,
+// the layout of init_sigmoid_table/init_tanh_table
+template<class table_T, class FN, int N_TABLE, int R, std::size_t... II>
+constexpr table_array<table_T, N_TABLE> make_lut_table(std::index_sequence<II...>)
+{
+    return {{ (table_T) FN::value((2 << R) * (double(II) - N_TABLE/2.0) / N_TABLE)... }};
+}
+
+// N_TABLE+1 entries of FN over [-2^R, 2^R], both ends included
+template<class table_T, class FN, int N_TABLE, int R, std::size_t... II>
+constexpr table_array<table_T, N_TABLE+1> make_interp_table(std::index_sequence<II...>)
+{
+    return {{ (table_T) FN::value((2.0 * II / N_TABLE - 1.0) * (1 << R))... }};
+}
+
+// Static tables, constant-initialized for float (no runtime init, no guard)
+template<class table_T, class FN, int N_TABLE, int R>
+struct lut_table {
+    static const table_array<table_T, N_TABLE> table;
+};
+
+template<class table_T, class FN, int N_TABLE, int R>
+const table_array<table_T, N_TABLE> lut_table<table_T, FN, N_TABLE, R>::table =
+    make_lut_table<table_T, FN, N_TABLE, R>(std::make_index_sequence<N_TABLE>());
+
+template<class table_T, class FN, int N_TABLE, int R>
+struct interp_table {
+    static const table_array<table_T, N_TABLE+1> table;
+};
+
+template<class table_T, class FN, int N_TABLE, int R>
+const table_array<table_T, N_TABLE+1> interp_table<table_T, FN, N_TABLE, R>::table =
+    make_interp_table<table_T, FN, N_TABLE, R>(std::make_index_sequence<N_TABLE+1>());
+
+// *************************************************
+//       Sigmoid/TanH approximations
+// *************************************************
+// Index into a 2^N_LOG2 entry table spanning [-2^R, 2^R), clamped at both ends
+template<int N_LOG2, int R, class data_T>
+int lut_index_direct(data_T x)
+{
+    #pragma HLS INLINE
+    int index = (int) std::floor(x * (1 << N_LOG2) / (2 << R)) + (1 << (N_LOG2-1));
+    if (index < 0) index = 0;
+    if (index > (1 << N_LOG2) - 1) index = (1 << N_LOG2) - 1;
+    return index;
+}
+
+// ap_fixed: the index is the N_LOG2 bits of the word weighted 2^R down to
+// 2^(R+1-N_LOG2), with the sign bit flipped. No multiplier, no adder.
+template<int N_LOG2, int R, int W, int I, ap_q_mode Q, ap_o_mode O, int N>
+int lut_index_direct(ap_fixed<W,I,Q,O,N> x)
+{
+    #pragma HLS INLINE
+    static_assert(W - I + R + 1 >= N_LOG2, "not enough fractional bits for a direct table index");
+    const int lo = W - I + R + 1 - N_LOG2;
+    // sign extend so that bit R exists even when I <= R+1
+    ap_fixed<W+R+2, I+R+2> xw = x;
+    if (xw >= (1 << R))  return (1 << N_LOG2) - 1;
+    if (xw < -(1 << R))  return 0;
+    ap_uint<N_LOG2> index = xw.range(lo + N_LOG2 - 1, lo);
+    index[N_LOG2-1] = !index[N_LOG2-1];
+    return index;
+}
+
+// Piecewise linear sigmoid (PLAN), slopes are powers of two
+template<class T>
+T sigmoid_pwl(T x)
+{
+    #pragma HLS INLINE
+    T ax = x < 0 ? (T) -x : x;
+    T y;
+    if (ax >= (T) 5)          y = 1;
+    else if (ax >= (T) 2.375) y = (T) 0.03125 * ax + (T) 0.84375;
+    else if (ax >= (T) 1)     y = (T) 0.125 * ax + (T) 0.625;
+    else                      y = (T) 0.25 * ax + (T) 0.5;
+    return x < 0 ? (T) (1 - y) : y;
+}
+
+// Second order sigmoid, 1 - (1 - |x|/4)^2 / 2 on |x| < 4
+template<class T>
+T sigmoid_poly(T x)
+{
+    #pragma HLS INLINE
+    T ax = x < 0 ? (T) -x : x;
+    if (ax > (T) 4) ax = 4;
+    T t = (T) 1 - (T) 0.25 * ax;
+    T y = (T) 1 - (T) 0.5 * t * t;
+    return x < 0 ? (T) (1 - y) : y;
+}
+
+// tanh(x) = 2*sigmoid(2x) - 1
+template<class T>
+T tanh_pwl(T x)
+{
+    #pragma HLS INLINE
+    return (T) 2 * sigmoid_pwl<T>((T) 2 * x) - (T) 1;
+}
+
+template<class T>
+T tanh_poly(T x)
+{
+    #pragma HLS INLINE
+    return (T) 2 * sigmoid_poly<T>((T) 2 * x) - (T) 1;
+}
+
+// Linear interpolation between the entries of an N_TABLE+1 entry table
+// spanning [-2^R, 2^R]
+template<class data_T, int N_TABLE, int R, class table_T>
+table_T interp_lookup(data_T x, const table_T table[N_TABLE+1])
+{
+    #pragma HLS INLINE
+    table_T pos = ((table_T) x + (table_T) (1 << R)) * (table_T) ((float) N_TABLE / (2 << R));
+    int index = (int) pos;
+    if (pos < 0) index = 0;
+    if (index > N_TABLE-1) index = N_TABLE-1;
+    table_T frac = pos - (table_T) index;
+    if (frac < 0) frac = 0;
+    if (frac > 1) frac = 1;
+    return table[index] + frac * (table[index+1] - table[index]);
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void  sigmoid_approx(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE
+    }
+
+    for (int ii=0; ii<CONFIG_T::n_in; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+        typename CONFIG_T::table_t x = data[ii];
+        if (CONFIG_T::activ_impl == activ_pwl) res[ii] = (res_T) sigmoid_pwl(x);
+        else                                   res[ii] = (res_T) sigmoid_poly(x);
+    }
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void  tanh_approx(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE
+    }
+
+    for (int ii=0; ii<CONFIG_T::n_in; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+        typename CONFIG_T::table_t x = data[ii];
+        if (CONFIG_T::activ_impl == activ_pwl) res[ii] = (res_T) tanh_pwl(x);
+        else                                   res[ii] = (res_T) tanh_poly(x);
+    }
+}
+
 // *************************************************
 //       Sigmoid Activation
 // *************************************************
@@ -140,20 +339,11 @@ void init_sigmoid_table(typename CONFIG_T::table_t table_out[N_TABLE])
 }
 
 template<class data_T, class res_T, typename CONFIG_T>
-void  sigmoid(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+void  sigmoid_lut(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
 {
-    // Initialize the lookup table
-#ifdef __HLS_SYN__
-    bool initialized = false;
-    typename CONFIG_T::table_t sigmoid_table[CONFIG_T::table_size];
-#else
-    static bool initialized = false;
-    static typename CONFIG_T::table_t sigmoid_table[CONFIG_T::table_size];
-#endif
-    if (!initialized) {
-        init_sigmoid_table<CONFIG_T, CONFIG_T::table_size>(sigmoid_table);
-        initialized = true;
-    }
+    // Lookup table, built at compile time (ROM in hardware)
+    const typename CONFIG_T::table_t (&sigmoid_table)[CONFIG_T::table_size] =
+        lut_table<typename CONFIG_T::table_t, sigmoid_constexpr, CONFIG_T::table_size, 3>::table.data;
 
     if (CONFIG_T::io_type == io_parallel){
         #pragma HLS PIPELINE
@@ -166,10 +356,14 @@ void  sigmoid(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
         if (CONFIG_T::io_type == io_serial){
             #pragma HLS PIPELINE
         }
-        data_round = data[ii]*CONFIG_T::table_size/16;
-        index = data_round + 8*CONFIG_T::table_size/16;
-        if (index < 0)   index = 0;
-        if (index > CONFIG_T::table_size-1) index = CONFIG_T::table_size-1;
+        if (CONFIG_T::activ_impl == activ_lut_direct) {
+            index = lut_index_direct<floorlog2(CONFIG_T::table_size), 3>(data[ii]);
+        } else {
+            data_round = data[ii]*CONFIG_T::table_size/16;
+            index = data_round + 8*CONFIG_T::table_size/16;
+            if (index < 0)   index = 0;
+            if (index > CONFIG_T::table_size-1) index = CONFIG_T::table_size-1;
+        }
         res[ii] = (res_T) sigmoid_table[index];
     }
 }
@@ -312,20 +506,11 @@ void init_tanh_table(typename CONFIG_T::table_t table_out[N_TABLE])
 
 
 template<class data_T, class res_T, typename CONFIG_T>
-void  tanh(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+void  tanh_lut(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
 {
-    // Initialize the lookup table
-#ifdef __HLS_SYN__
-    bool initialized = false;
-    typename CONFIG_T::table_t tanh_table[CONFIG_T::table_size];
-#else
-    static bool initialized = false;
-    static typename CONFIG_T::table_t tanh_table[CONFIG_T::table_size];
-#endif
-    if (!initialized) {
-        init_tanh_table<CONFIG_T, CONFIG_T::table_size>(tanh_table);
-        initialized = true;
-    }
+    // Lookup table, built at compile time (ROM in hardware)
+    const typename CONFIG_T::table_t (&tanh_table)[CONFIG_T::table_size] =
+        lut_table<typename CONFIG_T::table_t, tanh_constexpr, CONFIG_T::table_size, 2>::table.data;
 
     if (CONFIG_T::io_type == io_parallel){
         #pragma HLS PIPELINE
@@ -338,12 +523,222 @@ void  tanh(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
         if (CONFIG_T::io_type == io_serial){
             #pragma HLS PIPELINE
         }
-        data_round = data[ii]*CONFIG_T::table_size/8;
+        if (CONFIG_T::activ_impl == activ_lut_direct) {
+            index = lut_index_direct<floorlog2(CONFIG_T::table_size), 2>(data[ii]);
+        } else {
+            data_round = data[ii]*CONFIG_T::table_size/8;
+            index = data_round + 4*CONFIG_T::table_size/8;
+            //std::cout << "Input: "  << data[ii] << " Round: " << data_round << " Index: " << index << std::endl;
+            if (index < 0)   index = 0;
+            if (index > CONFIG_T::table_size-1) index = CONFIG_T::table_size-1;
+        }
+        res[ii] = (res_T) tanh_table[index];
+    }
+}
+
+// *************************************************
+//       Interpolated Sigmoid / TanH
+// *************************************************
+template<class data_T, class res_T, typename CONFIG_T>
+void  sigmoid_interp(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    const typename CONFIG_T::table_t (&sigmoid_table)[CONFIG_T::interp_table_size+1] =
+        interp_table<typename CONFIG_T::table_t, sigmoid_constexpr, CONFIG_T::interp_table_size, 3>::table.data;
+
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE
+    }
+
+    for (int ii=0; ii<CONFIG_T::n_in; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+        res[ii] = (res_T) interp_lookup<data_T, CONFIG_T::interp_table_size, 3>(data[ii], sigmoid_table);
+    }
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void  tanh_interp(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    const typename CONFIG_T::table_t (&tanh_table)[CONFIG_T::interp_table_size+1] =
+        interp_table<typename CONFIG_T::table_t, tanh_constexpr, CONFIG_T::interp_table_size, 2>::table.data;
+
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE
+    }
+
+    for (int ii=0; ii<CONFIG_T::n_in; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+        res[ii] = (res_T) interp_lookup<data_T, CONFIG_T::interp_table_size, 2>(data[ii], tanh_table);
+    }
+}
+
+// *************************************************
+//       Sigmoid + TanH from one table
+// *************************************************
+// sigmoid(x) = 0.5 * (1 + tanh(x/2)). Halving x maps the +-8 sigmoid range
+// onto the +-4 tanh table, so both functions read the same table; only the
+// index scale and the output shift/add differ. The first N_SIG elements go
+// through sigmoid, the remaining N_TANH through tanh. With reuse_factor > 1
+// the lookups are spread over II cycles on fewer table ports.
+template<class data_T, class res_T, typename CONFIG_T, int N_SIG, int N_TANH>
+void  sigmoid_tanh(data_T data[N_SIG+N_TANH], res_T res[N_SIG+N_TANH])
+{
+    // Lookup table, built at compile time (ROM in hardware)
+    const typename CONFIG_T::table_t (&tanh_table)[CONFIG_T::table_size] =
+        lut_table<typename CONFIG_T::table_t, tanh_constexpr, CONFIG_T::table_size, 2>::table.data;
+
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+    }
+
+    int data_round;
+    int index;
+    for (int ii=0; ii<N_SIG+N_TANH; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+        if (ii < N_SIG) data_round = data[ii]*CONFIG_T::table_size/16;
+        else            data_round = data[ii]*CONFIG_T::table_size/8;
         index = data_round + 4*CONFIG_T::table_size/8;
-        //std::cout << "Input: "  << data[ii] << " Round: " << data_round << " Index: " << index << std::endl;
         if (index < 0)   index = 0;
         if (index > CONFIG_T::table_size-1) index = CONFIG_T::table_size-1;
-        res[ii] = (res_T) tanh_table[index];
+        typename CONFIG_T::table_t t = tanh_table[index];
+        if (ii < N_SIG) res[ii] = (res_T) ((typename CONFIG_T::table_t) 0.5 + (typename CONFIG_T::table_t) 0.5 * t);
+        else            res[ii] = (res_T) t;
+    }
+}
+
+// *************************************************
+//       Exact Sigmoid / TanH
+// *************************************************
+// Float-accurate (a few ulp) exp and tanh, as in the Cephes expf/tanhf:
+// range reduction to [-ln2/2, ln2/2] plus a degree 6 polynomial for exp,
+// an odd polynomial below 0.625 and 1 - 2/(exp(2|x|)+1) above for tanh.
+// Clamps and selects are done on the integer bit patterns: there is no
+// table and no branch, so the element loops below vectorize and the
+// 4*length_h gate values of a timestep take a few vector instructions.
+// In synthesis hls::exp/hls::tanh are used instead.
+inline uint32_t float_as_bits(float x)
+{
+    uint32_t b;
+    std::memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+inline float bits_as_float(uint32_t b)
+{
+    float x;
+    std::memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+inline float exp_exact_float(float x)
+{
+    // |x| <= 88, so the exponent below stays in [-127, 127]
+    uint32_t xb = float_as_bits(x);
+    uint32_t ab = xb & 0x7fffffffu;
+    ab = ab > 0x42b00000u ? 0x42b00000u : ab;
+    x = bits_as_float((xb & 0x80000000u) | ab);
+    // n = round(x/ln2), kept in the mantissa of 1.5*2^23
+    float n = x * 1.44269504088896341f + 12582912.0f;
+    float fx = n - 12582912.0f;
+    x = x - fx * 0.693359375f + fx * 2.12194440e-4f;
+    float z = x * x;
+    float y = ((((( 1.9875691500E-4f * x + 1.3981999507E-3f) * x
+                  + 8.3334519073E-3f) * x + 4.1665795894E-2f) * x
+                  + 1.6666665459E-1f) * x + 5.0000001201E-1f) * z + x + 1.0f;
+    // y * 2^n through the exponent field
+    int32_t e = ((int32_t) float_as_bits(n) - 0x4b400000 + 127) << 23;
+    return y * bits_as_float((uint32_t) e);
+}
+
+inline float sigmoid_exact_float(float x)
+{
+    return 1.0f / (1.0f + exp_exact_float(-x));
+}
+
+inline float tanh_exact_float(float x)
+{
+    uint32_t xb = float_as_bits(x);
+    float ax = bits_as_float(xb & 0x7fffffffu);
+    float z = x * x;
+    float small = ((((-5.70498872745E-3f * z + 2.06390887954E-2f) * z
+                     - 5.37397155531E-2f) * z + 1.33314422036E-1f) * z
+                     - 3.33332819422E-1f) * z * x + x;
+    float large = 1.0f - 2.0f / (exp_exact_float(2.0f * ax) + 1.0f);
+    uint32_t lb = float_as_bits(large) | (xb & 0x80000000u);
+    // |x| < 0.625 ? small : large
+    uint32_t mask = 0u - (uint32_t) ((xb & 0x7fffffffu) < 0x3f200000u);
+    return bits_as_float((float_as_bits(small) & mask) | (lb & ~mask));
+}
+
+// The first N_SIG elements through sigmoid, the remaining N_TANH through tanh
+template<class data_T, class res_T, typename CONFIG_T, int N_SIG, int N_TANH>
+void  sigmoid_tanh_exact(data_T data[N_SIG+N_TANH], res_T res[N_SIG+N_TANH])
+{
+    if (CONFIG_T::io_type == io_parallel){
+        #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+    }
+
+    for (int ii=0; ii<N_SIG; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+#ifdef __SYNTHESIS__
+        res[ii] = (res_T) ((data_T)1.0 / ((data_T)1.0 + hls::exp(-data[ii])));
+#else
+        res[ii] = (res_T) sigmoid_exact_float((float) data[ii]);
+#endif
+    }
+    for (int ii=N_SIG; ii<N_SIG+N_TANH; ii++) {
+        if (CONFIG_T::io_type == io_serial){
+            #pragma HLS PIPELINE
+        }
+#ifdef __SYNTHESIS__
+        res[ii] = (res_T) hls::tanh(data[ii]);
+#else
+        res[ii] = (res_T) tanh_exact_float((float) data[ii]);
+#endif
+    }
+}
+
+// *************************************************
+//       TanH / Sigmoid dispatch on activ_impl
+// *************************************************
+template<class data_T, class res_T, typename CONFIG_T>
+void  tanh(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    #pragma HLS INLINE
+    if (CONFIG_T::activ_impl == activ_lut_interp) {
+        tanh_interp<data_T, res_T, CONFIG_T>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_pwl || CONFIG_T::activ_impl == activ_poly) {
+        tanh_approx<data_T, res_T, CONFIG_T>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_lut_shared) {
+        sigmoid_tanh<data_T, res_T, CONFIG_T, 0, CONFIG_T::n_in>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_exact) {
+        sigmoid_tanh_exact<data_T, res_T, CONFIG_T, 0, CONFIG_T::n_in>(data, res);
+    } else {
+        tanh_lut<data_T, res_T, CONFIG_T>(data, res);
+    }
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void  sigmoid(data_T data[CONFIG_T::n_in], res_T res[CONFIG_T::n_in])
+{
+    #pragma HLS INLINE
+    if (CONFIG_T::activ_impl == activ_lut_interp) {
+        sigmoid_interp<data_T, res_T, CONFIG_T>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_pwl || CONFIG_T::activ_impl == activ_poly) {
+        sigmoid_approx<data_T, res_T, CONFIG_T>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_lut_shared) {
+        sigmoid_tanh<data_T, res_T, CONFIG_T, CONFIG_T::n_in, 0>(data, res);
+    } else if (CONFIG_T::activ_impl == activ_exact) {
+        sigmoid_tanh_exact<data_T, res_T, CONFIG_T, CONFIG_T::n_in, 0>(data, res);
+    } else {
+        sigmoid_lut<data_T, res_T, CONFIG_T>(data, res);
     }
 }
 
@@ -34,6 +34,14 @@ enum io_type {io_parallel = 0, io_serial};
 // Activation enum
 enum activ_type {activ_relu = 0, activ_sigmoid, activ_tanh, activ_softmax};
 
+// Sigmoid/tanh implementation: full table (float index or, for ap_fixed,
+// bit-sliced index), small interpolated table, piecewise linear, polynomial,
+// one tanh table serving both functions, float-exact (hls_math in synthesis)
+enum activ_impl_type {activ_lut = 0, activ_lut_direct, activ_lut_interp, activ_pwl, activ_poly, activ_lut_shared, activ_exact};
+
+// Accumulation enum: serial chain or balanced adder tree
+enum accum_type {accum_serial = 0, accum_tree};
+
 // Default data types (??) TODO: Deprecate
 typedef ap_fixed<16,4>  weight_t_def;
 typedef ap_fixed<16,4>  bias_t_def;
@@ -53,6 +61,35 @@ typedef ap_fixed<32,10> accum_t_def;
    }
  }
 
+constexpr int ceillog2(int x){
+  return (x <= 2) ? 1 : 1 + ceillog2((x+1) / 2);
+}
+
+constexpr int floorlog2(int x){
+  return (x < 2) ? 0 : 1 + floorlog2(x / 2);
+}
+
+constexpr int pow2(int x){
+  return x == 0 ? 1 : 2 * pow2(x - 1);
+}
+
+// Balanced binary adder tree, ceil(log2(N)) adds deep
+template<class T, int N>
+struct adder_tree {
+    static T sum(T x[N]) {
+        #pragma HLS INLINE
+        return adder_tree<T, N/2>::sum(x) + adder_tree<T, N - N/2>::sum(x + N/2);
+    }
+};
+
+template<class T>
+struct adder_tree<T, 1> {
+    static T sum(T x[1]) {
+        #pragma HLS INLINE
+        return x[0];
+    }
+};
+
 }
 
 #endif
@@ -44,9 +44,41 @@ struct dense_config
     static const unsigned reuse_factor = 1;
     static const bool store_weights_in_bram = false;
     static const unsigned n_zeros = 0;
+    static const unsigned accum_type = accum_serial;
+    typedef ap_int<8> exponent_t;
     // partitioning arrays cyclically to go with roll factors?
 };
 
+// One nonzero of a pruned n_in x n_out weight matrix, the (row, col, weight)
+// triples read by load_compressed_weights_from_txt
+template<class weight_T>
+struct compressed_weight {
+    unsigned short row_index;
+    unsigned short col_index;
+    weight_T weight;
+};
+
+// Power-of-two weight (-1)^sign * 2^weight, the (sign, exponent) pairs read
+// by load_exponent_weights_from_txt
+template<class exp_T>
+struct exponent_weight {
+    exp_T sign;
+    exp_T weight;
+};
+
+// x * 2^e: a shift for ap_fixed, an exponent adjustment for float
+template<int W, int I, ap_q_mode Q, ap_o_mode O, int N>
+ap_fixed<W,I,Q,O,N> shift_pow2(ap_fixed<W,I,Q,O,N> x, int e)
+{
+    #pragma HLS INLINE
+    return (e >= 0) ? ap_fixed<W,I,Q,O,N>(x << e) : ap_fixed<W,I,Q,O,N>(x >> -e);
+}
+
+inline float shift_pow2(float x, int e)
+{
+    return std::ldexp(x, e);
+}
+
 
 template<class data_T, class res_T, typename CONFIG_T>
 void dense_simple(
@@ -78,6 +110,17 @@ void dense_simple(
     #pragma HLS ALLOCATION instances=mul limit=multiplier_limit operation
 
 
+    // Runtime-loaded weights sit in dual-port RAM: a bank per two weights
+    // read each of the reuse_factor cycles, but at most one per output, so
+    // a small reuse_factor does not dissolve them into registers. Compiled-in
+    // weights keep a factor of 1, no partition.
+    enum {
+        weight_banks = CONFIG_T::store_weights_in_bram ? MIN(DIV_ROUNDUP(CONFIG_T::n_in*CONFIG_T::n_out, (2*CONFIG_T::reuse_factor)), CONFIG_T::n_out) : 1,
+        bias_banks = CONFIG_T::store_weights_in_bram ? CONFIG_T::n_out : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=weights cyclic factor=weight_banks
+    #pragma HLS ARRAY_PARTITION variable=biases cyclic factor=bias_banks
+
     if(CONFIG_T::reuse_factor >= 2) {
     	int cyclic_num = (CONFIG_T::n_in*CONFIG_T::n_out)/2;
 		//#pragma HLS ARRAY_PARTITION variable=weights cyclic factor=cyclic_num
@@ -104,17 +147,245 @@ void dense_simple(
     }
 
     // Accumulate multiplication result
+    if (CONFIG_T::accum_type == accum_tree) {
+        // Reduce each output with an adder tree, O(log n_in) adds deep
+        AccumTree: for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+            typename CONFIG_T::accum_t col[CONFIG_T::n_in];
+            #pragma HLS ARRAY_PARTITION variable=col complete
+            AccumCol: for(int ii = 0; ii < CONFIG_T::n_in; ii++) {
+                col[ii] = mult[ii*CONFIG_T::n_out+jj];
+            }
+            acc[jj] += adder_tree<typename CONFIG_T::accum_t, CONFIG_T::n_in>::sum(col);
+        }
+    }
+    else {
+        Accum1: for(int ii = 0; ii < CONFIG_T::n_in; ii++) {
+            Accum2: for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+                int index = ii*CONFIG_T::n_out+jj;
+                acc[jj] += mult[index];
+            }
+        }
+    }
+
+    // Cast to "res_t" type
+    Result: for(int ires = 0; ires < CONFIG_T::n_out; ires++){
+        res[ires] = (res_T) (acc[ires]);
+        //res[ires] = cast<data_T, res_T, CONFIG_T>(acc[ires]);
+    }
+}
+
+// Dense layer over the n_in*n_out - n_zeros nonzeros of a pruned matrix.
+// Only the stored weights get a multiplier (and a MAC on CPU).
+template<class data_T, class res_T, typename CONFIG_T>
+void dense_sparse(
+    data_T    data[CONFIG_T::n_in],
+    res_T     res[CONFIG_T::n_out],
+    compressed_weight<typename CONFIG_T::weight_t> weights[CONFIG_T::n_in*CONFIG_T::n_out - CONFIG_T::n_zeros],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    const int n_nonzeros = CONFIG_T::n_in*CONFIG_T::n_out - CONFIG_T::n_zeros;
+    typename CONFIG_T::accum_t acc[CONFIG_T::n_out];
+
+    // With the weights instantiated as constants the row/col indices fold away
+    #pragma HLS function_instantiate variable=weights,biases
+
+    #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+
+    #pragma HLS ARRAY_PARTITION variable=weights complete
+    #pragma HLS ARRAY_PARTITION variable=acc complete
+    #pragma HLS ARRAY_PARTITION variable=res complete
+
+    int multiplier_limit  = DIV_ROUNDUP(n_nonzeros, CONFIG_T::reuse_factor);
+    #pragma HLS ALLOCATION instances=mul limit=multiplier_limit operation
+
+    // Initialize accumulator with input biases
+    ResetAccum: for(int iacc = 0; iacc < CONFIG_T::n_out; iacc++) {
+        acc[iacc] = (typename CONFIG_T::accum_t) biases[iacc];
+    }
+
+    // Multiply-accumulate the nonzeros only
+    SparseAccum: for(int iw = 0; iw < n_nonzeros; iw++) {
+        typename CONFIG_T::mult_t mult = data[weights[iw].row_index] * weights[iw].weight;
+        acc[weights[iw].col_index] += mult;
+    }
+
+    // Cast to "res_t" type
+    Result: for(int ires = 0; ires < CONFIG_T::n_out; ires++){
+        res[ires] = (res_T) (acc[ires]);
+    }
+}
+
+// Dense layer with power-of-two weights: every MAC is a shift and an add,
+// no multipliers are built
+template<class data_T, class res_T, typename CONFIG_T>
+void dense_pow2(
+    data_T    data[CONFIG_T::n_in],
+    res_T     res[CONFIG_T::n_out],
+    exponent_weight<typename CONFIG_T::exponent_t> weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    typename CONFIG_T::accum_t acc[CONFIG_T::n_out];
+
+    // Constant exponents turn the shifts into wiring
+    #pragma HLS function_instantiate variable=weights,biases
+
+    #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+
+    #pragma HLS ARRAY_PARTITION variable=acc complete
+    #pragma HLS ARRAY_PARTITION variable=res complete
+
+    // Initialize accumulator with input biases
+    ResetAccum: for(int iacc = 0; iacc < CONFIG_T::n_out; iacc++) {
+        acc[iacc] = (typename CONFIG_T::accum_t) biases[iacc];
+    }
+
+    // Shift-accumulate, in the accumulator type so that left shifts do not overflow
     Accum1: for(int ii = 0; ii < CONFIG_T::n_in; ii++) {
+        typename CONFIG_T::accum_t cache = data[ii];
         Accum2: for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
             int index = ii*CONFIG_T::n_out+jj;
-            acc[jj] += mult[index];
+            typename CONFIG_T::accum_t term = shift_pow2(cache, weights[index].weight);
+            if (weights[index].sign) acc[jj] -= term;
+            else                     acc[jj] += term;
         }
     }
 
     // Cast to "res_t" type
     Result: for(int ires = 0; ires < CONFIG_T::n_out; ires++){
         res[ires] = (res_T) (acc[ires]);
-        //res[ires] = cast<data_T, res_T, CONFIG_T>(acc[ires]);
+    }
+}
+
+// Dense layer picking the kernel from the weight encoding: plain weight_t
+// arrays go to dense_simple, compressed_weight arrays to dense_sparse and
+// exponent_weight arrays to dense_pow2
+template<class data_T, class res_T, typename CONFIG_T>
+void dense(
+    data_T    data[CONFIG_T::n_in],
+    res_T     res[CONFIG_T::n_out],
+    typename CONFIG_T::weight_t  weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    #pragma HLS INLINE
+    dense_simple<data_T, res_T, CONFIG_T>(data, res, weights, biases);
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void dense(
+    data_T    data[CONFIG_T::n_in],
+    res_T     res[CONFIG_T::n_out],
+    compressed_weight<typename CONFIG_T::weight_t> weights[CONFIG_T::n_in*CONFIG_T::n_out - CONFIG_T::n_zeros],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    #pragma HLS INLINE
+    dense_sparse<data_T, res_T, CONFIG_T>(data, res, weights, biases);
+}
+
+template<class data_T, class res_T, typename CONFIG_T>
+void dense(
+    data_T    data[CONFIG_T::n_in],
+    res_T     res[CONFIG_T::n_out],
+    exponent_weight<typename CONFIG_T::exponent_t> weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    #pragma HLS INLINE
+    dense_pow2<data_T, res_T, CONFIG_T>(data, res, weights, biases);
+}
+
+// Streaming (io_serial) dense layer: one input element per beat, each beat
+// accumulated into all n_out outputs; n_out result beats once the input is
+// consumed. weights are read row by row, index = ii*n_out + jj as above.
+template<class data_T, class res_T, typename CONFIG_T>
+void dense(
+    hls::stream<data_T> &data,
+    hls::stream<res_T>  &res,
+    typename CONFIG_T::weight_t  weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    typename CONFIG_T::accum_t acc[CONFIG_T::n_out];
+    #pragma HLS ARRAY_PARTITION variable=acc complete
+    #pragma HLS ARRAY_RESHAPE variable=weights cyclic factor=CONFIG_T::n_out
+
+    ResetAccumS: for(int iacc = 0; iacc < CONFIG_T::n_out; iacc++) {
+        #pragma HLS UNROLL
+        acc[iacc] = (typename CONFIG_T::accum_t) biases[iacc];
+    }
+
+    AccumS: for(int ii = 0; ii < CONFIG_T::n_in; ii++) {
+        #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+        data_T cache = data.read();
+        AccumRowS: for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+            acc[jj] += cache * weights[ii*CONFIG_T::n_out+jj];
+        }
+    }
+
+    ResultS: for(int ires = 0; ires < CONFIG_T::n_out; ires++){
+        #pragma HLS PIPELINE
+        res.write((res_T) acc[ires]);
+    }
+}
+
+// TimeDistributed dense over a whole sequence: the n_ts input vectors as one
+// [n_ts x n_in] x [n_in x n_out] product, run after the recurrence instead
+// of once per timestep inside it (a separate DATAFLOW stage in hardware).
+// The loop over time is innermost, so in software it vectorizes across
+// timesteps. Each output accumulates bias first, then inputs in order, as in
+// dense_simple; accum_tree configs go through dense_simple per timestep.
+template<class data_T, class res_T, typename CONFIG_T, int N_TS>
+void dense_td(
+    data_T    data[N_TS*CONFIG_T::n_in],
+    res_T     res[N_TS*CONFIG_T::n_out],
+    typename CONFIG_T::weight_t  weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    if (CONFIG_T::accum_type == accum_tree) {
+        TimestepTD: for(int its = 0; its < N_TS; its++) {
+            dense_simple<data_T, res_T, CONFIG_T>(&data[its*CONFIG_T::n_in], &res[its*CONFIG_T::n_out], weights, biases);
+        }
+        return;
+    }
+
+    typename CONFIG_T::accum_t acc[CONFIG_T::n_out][N_TS];
+
+    #pragma HLS function_instantiate variable=weights,biases
+    #pragma HLS PIPELINE II=CONFIG_T::reuse_factor
+    #pragma HLS ARRAY_PARTITION variable=acc complete dim=0
+
+    int multiplier_limit = DIV_ROUNDUP(N_TS*CONFIG_T::n_in*CONFIG_T::n_out, CONFIG_T::reuse_factor);
+    #pragma HLS ALLOCATION instances=mul limit=multiplier_limit operation
+
+    ResetAccumTD: for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+        for(int its = 0; its < N_TS; its++) {
+            acc[jj][its] = (typename CONFIG_T::accum_t) biases[jj];
+        }
+    }
+
+    AccumTD: for(int ii = 0; ii < CONFIG_T::n_in; ii++) {
+        for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+            typename CONFIG_T::weight_t w = weights[ii*CONFIG_T::n_out+jj];
+            for(int its = 0; its < N_TS; its++) {
+                acc[jj][its] += (typename CONFIG_T::mult_t) (data[its*CONFIG_T::n_in+ii] * w);
+            }
+        }
+    }
+
+    ResultTD: for(int its = 0; its < N_TS; its++) {
+        for(int jj = 0; jj < CONFIG_T::n_out; jj++) {
+            res[its*CONFIG_T::n_out+jj] = (res_T) acc[jj][its];
+        }
+    }
+}
+
+// Streaming TimeDistributed dense: n_in beats in, n_out beats out per timestep
+template<class data_T, class res_T, typename CONFIG_T, int N_TS>
+void dense_td(
+    hls::stream<data_T> &data,
+    hls::stream<res_T>  &res,
+    typename CONFIG_T::weight_t  weights[CONFIG_T::n_in*CONFIG_T::n_out],
+    typename CONFIG_T::bias_t    biases[CONFIG_T::n_out])
+{
+    TimestepTDS: for(int its = 0; its < N_TS; its++) {
+        dense<data_T, res_T, CONFIG_T>(data, res, weights, biases);
     }
 }
 
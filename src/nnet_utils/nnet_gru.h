@@ -0,0 +1,494 @@
+#ifndef NNET_GRU_H_
+#define NNET_GRU_H_
+
+#include <cstdlib>
+#include "nnet_activation.h"
+#include "nnet_dense.h"
+#include "nnet_lstm.h"
+#include <math.h>
+#include <assert.h>
+#include <type_traits>
+
+namespace nnet {
+
+// GRU cell as in torch.nn.GRU, gate order r, z, n:
+//   r = sigmoid(W_ir x + b_ir + W_hr h + b_hr)
+//   z = sigmoid(W_iz x + b_iz + W_hz h + b_hz)
+//   n = tanh(W_in x + b_in + r * (W_hn h + b_hn))
+//   h = (1 - z) * n + z * h
+// Weights are laid out as for the LSTM with 3 instead of 4 gates
+// (weights_x[length_x * length_h * 3], weights_h[length_h * length_h * 3]).
+// b_hn sits inside the r product, so the input and recurrent biases can not
+// be folded into one: biases[length_h * 6] holds b_ih, then b_hh.
+// CONFIG_X/CONFIG_H are the dense configs of the two projections
+// (n_out = length_h * 3).
+struct gru_config
+{
+    // Internal data type definitions
+    typedef float bias_t;
+    typedef float weight_t;
+    typedef float accum_t;
+    typedef float mult_t;
+
+    // parameters
+    static const unsigned length_x = 4;
+    static const unsigned length_h = 4;
+    static const unsigned timestep = 4;
+
+    static const unsigned reuse_factor = 1;
+    static const unsigned reuse_factor_tail = 1;
+    // timesteps sharing one cell datapath; timestep means no unroll
+    static const unsigned reuse_factor_ts = 4;
+    // largest length_h run through gru_cell_fused in software builds
+    static const unsigned cpu_fused_max_h = 16;
+    static const bool store_weights_in_bram = false;
+};
+
+
+// h_cur = n + z * (h_pre - n), i.e. (1 - z) * n + z * h_pre with one multiply
+template<class data_T, typename CONFIG_T>
+void gru_tail(
+    data_T gate_z[CONFIG_T::length_h],
+    data_T gate_n[CONFIG_T::length_h],
+    data_T h_pre[CONFIG_T::length_h],
+// output
+    data_T h_cur[CONFIG_T::length_h]
+){
+
+    #pragma HLS PIPELINE II=CONFIG_T::reuse_factor_tail
+
+    enum { multiplier_limit = DIV_ROUNDUP(CONFIG_T::length_h, CONFIG_T::reuse_factor_tail) };
+    #pragma HLS ALLOCATION instances=mul limit=multiplier_limit operation
+
+    HIDDEN_UNITS:
+    for(int itail = 0; itail < CONFIG_T::length_h; itail++){
+        h_cur[itail] = gate_n[itail] + gate_z[itail] * (h_pre[itail] - gate_n[itail]);
+    }
+}
+
+#ifndef __SYNTHESIS__
+// *************************************************
+//       Fused GRU cell (software builds)
+// *************************************************
+// Encoded (compressed/exponent) weights: not handled, use gru_step
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+bool gru_cell_fused(
+    data_T input_x[CONFIG_T::length_x],
+    weight_x_T weights_x[],
+    weight_h_T weights_h[],
+    typename CONFIG_T::bias_t biases[CONFIG_T::length_h * 6],
+    data_T h_state[CONFIG_T::length_h],
+    std::false_type
+){
+    return false;
+}
+
+// One timestep of a small cell, both projections as row-wise
+// multiply-adds (see lstm_cell_fused) into two 3*length_h accumulators,
+// then the gates and the update in place. Results are identical to
+// gru_step's.
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H>
+bool gru_cell_fused(
+    data_T input_x[CONFIG_T::length_x],
+    typename CONFIG_X::weight_t weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    typename CONFIG_H::weight_t weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t biases[CONFIG_T::length_h * 6],
+    data_T h_state[CONFIG_T::length_h],
+    std::true_type
+){
+    const int NH = CONFIG_T::length_h;
+    typename CONFIG_T::accum_t acc_x[NH * 3];
+    typename CONFIG_T::accum_t acc_h[NH * 3];
+    typename CONFIG_T::accum_t gate_n[NH];
+    data_T activ[NH * 3];
+
+    for (int jj = 0; jj < NH * 3; jj++) {
+        acc_x[jj] = (typename CONFIG_T::accum_t) biases[jj];
+        acc_h[jj] = (typename CONFIG_T::accum_t) biases[NH * 3 + jj];
+    }
+    lstm_fused_project<data_T, CONFIG_X>(input_x, weights_x, acc_x);
+    lstm_fused_project<data_T, CONFIG_H>(h_state, weights_h, acc_h);
+
+    for (int jj = 0; jj < NH * 2; jj++) acc_x[jj] += acc_h[jj];
+    sigmoid<typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc_x,      activ);
+    sigmoid<typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc_x + NH, activ + NH);
+    for (int ii = 0; ii < NH; ii++) gate_n[ii] = acc_x[2 * NH + ii] + activ[ii] * acc_h[2 * NH + ii];
+    tanh<typename CONFIG_T::accum_t, data_T, CONFIG_A>(gate_n, activ + 2 * NH);
+
+    for (int ii = 0; ii < NH; ii++) {
+        h_state[ii] = activ[2 * NH + ii] + activ[NH + ii] * (h_state[ii] - activ[2 * NH + ii]);
+    }
+    return true;
+}
+#endif
+
+// One GRU timestep: gate projections of x_t and h_{t-1}, activations and
+// the hidden update. h_state is updated in place.
+// weights_x/weights_h may be plain, compressed_weight or exponent_weight arrays, see nnet::dense
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void gru_step(
+    data_T input_x[CONFIG_T::length_x],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+    data_T h_state[CONFIG_T::length_h]
+){
+    #pragma HLS INLINE
+
+#ifndef __SYNTHESIS__
+    // Small cells with plain weights take the fused software kernel
+    typedef std::integral_constant<bool,
+        std::is_same<weight_x_T, typename CONFIG_X::weight_t>::value &&
+        std::is_same<weight_h_T, typename CONFIG_H::weight_t>::value> plain_weights;
+    if (CONFIG_T::length_h <= CONFIG_T::cpu_fused_max_h &&
+        gru_cell_fused<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(
+            input_x, weights_x, weights_h, biases, h_state, plain_weights())) {
+        return;
+    }
+#endif
+
+    typename CONFIG_T::accum_t acc_x[CONFIG_T::length_h * 3];
+    typename CONFIG_T::accum_t acc_h[CONFIG_T::length_h * 3];
+
+    data_T h_cur[CONFIG_T::length_h];
+
+    typename CONFIG_T::accum_t gate_r[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t gate_z[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t gate_n[CONFIG_T::length_h];
+    data_T gate_r_activ[CONFIG_T::length_h];
+    data_T gate_z_activ[CONFIG_T::length_h];
+    data_T gate_n_activ[CONFIG_T::length_h];
+
+    // Both projections are independent; only the n gate needs them apart
+    dense<data_T, typename CONFIG_T::accum_t, CONFIG_X>(input_x, acc_x, weights_x, biases);
+    dense<data_T, typename CONFIG_T::accum_t, CONFIG_H>(h_state, acc_h, weights_h, &biases[CONFIG_T::length_h * 3]);
+
+    GATES_SPLIT:
+    for(int igate = 0; igate < CONFIG_T::length_h; igate++){
+        #pragma HLS UNROLL
+        gate_r[igate] = acc_x[igate] + acc_h[igate];
+        gate_z[igate] = acc_x[1*CONFIG_T::length_h+igate] + acc_h[1*CONFIG_T::length_h+igate];
+    }
+
+    sigmoid <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_r, gate_r_activ);
+    sigmoid <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_z, gate_z_activ);
+
+    GATE_N:
+    for(int igate = 0; igate < CONFIG_T::length_h; igate++){
+        #pragma HLS UNROLL
+        gate_n[igate] = acc_x[2*CONFIG_T::length_h+igate] + gate_r_activ[igate] * acc_h[2*CONFIG_T::length_h+igate];
+    }
+
+    tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_n, gate_n_activ);
+
+    gru_tail<data_T, CONFIG_T> (gate_z_activ, gate_n_activ, h_state, h_cur);
+
+    STATE:
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS UNROLL
+        h_state[ii] = h_cur[ii];
+    }
+}// gru_step
+
+
+// GRU layer with the sequence return
+// output: hidden_size x timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void gru_seq(
+    data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+    res_T  res[CONFIG_T::length_h*CONFIG_T::timestep]
+){
+
+    #pragma HLS INLINE
+
+    data_T h_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1,
+        res_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_h : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+    #pragma HLS ARRAY_PARTITION variable=res cyclic factor=res_factor
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TIMESTEP:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        #pragma HLS PIPELINE rewind
+
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS UNROLL
+            input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+
+        OUTPUT:
+        for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+            #pragma HLS UNROLL
+            res[ii+its*CONFIG_T::length_h] = (res_T) h_state[ii];
+        }
+    }
+
+}// gru_seq
+
+
+// GRU layer without the sequence return
+// output: only the final hidden units
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void gru(
+    data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+    res_T  res[CONFIG_T::length_h]
+){
+
+    #pragma HLS INLINE
+
+    data_T h_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TS:
+    for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        #pragma HLS PIPELINE rewind
+
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS UNROLL
+            input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+    }
+
+    OUTPUT_FINAL: for(int ii = 0; ii < CONFIG_T::length_h; ii++) {
+        #pragma HLS unroll
+        res[ii] = (res_T) h_state[ii];
+    }
+
+}// gru
+
+
+// GRU + TimeDistributed Dense
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, typename CONFIG_TD, class weight_x_T, class weight_h_T, class weight_td_T>
+void gru_seq_td(
+    data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+
+    weight_td_T weights_td[CONFIG_TD::n_in * CONFIG_TD::n_out],
+    typename CONFIG_TD::bias_t   biases_td [CONFIG_TD::n_out],
+    res_T  res[CONFIG_TD::n_out*CONFIG_T::timestep]
+){
+
+    #pragma HLS INLINE
+
+    data_T h_state[CONFIG_T::length_h];
+    res_T tdense_out[CONFIG_TD::n_out];
+    data_T input_x[CONFIG_T::length_x];
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1,
+        res_factor = ts_unroll > 1 ? ts_unroll * CONFIG_TD::n_out : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+    #pragma HLS ARRAY_PARTITION variable=res cyclic factor=res_factor
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TIMESTEP_TD:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        #pragma HLS PIPELINE rewind
+
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS UNROLL
+            input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+
+        nnet::dense<data_T, res_T, CONFIG_TD>(h_state, tdense_out, weights_td, biases_td);
+
+        OUTPUT_FINAL: for(int ii = 0; ii < CONFIG_TD::n_out; ii++) {
+            #pragma HLS unroll
+            res[ii+its*CONFIG_TD::n_out] = (res_T) tdense_out[ii];
+        }
+    }
+
+}// gru_seq_td
+
+
+// *************************************************
+//       Streaming (io_serial) GRU layers
+// *************************************************
+// Same beat layout as the streaming LSTM layers.
+
+// GRU layer with the sequence return, length_h elements per timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void gru_seq(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see gru_seq; the
+    // copies take their input beats one after the other
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TIMESTEP_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+
+        OUTPUT:
+        for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+            #pragma HLS PIPELINE
+            res.write((res_T) h_state[ii]);
+        }
+    }
+
+}// gru_seq (stream)
+
+
+// GRU layer without the sequence return, length_h elements after the last timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void gru(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see gru_seq (stream)
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TS_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+    }
+
+    OUTPUT_FINAL:
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS PIPELINE
+        res.write((res_T) h_state[ii]);
+    }
+
+}// gru (stream)
+
+
+// GRU + TimeDistributed Dense, n_out elements per timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, typename CONFIG_TD, class weight_x_T, class weight_h_T, class weight_td_T>
+void gru_seq_td(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 3],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 3],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 6],
+
+    weight_td_T weights_td[CONFIG_TD::n_in * CONFIG_TD::n_out],
+    typename CONFIG_TD::bias_t   biases_td [CONFIG_TD::n_out],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    res_T tdense_out[CONFIG_TD::n_out];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see gru_seq (stream)
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+    }
+
+    GRU_TIMESTEP_TD_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
+        }
+
+        gru_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state);
+
+        nnet::dense<data_T, res_T, CONFIG_TD>(h_state, tdense_out, weights_td, biases_td);
+
+        OUTPUT:
+        for(int ii = 0; ii < CONFIG_TD::n_out; ii++){
+            #pragma HLS PIPELINE
+            res.write(tdense_out[ii]);
+        }
+    }
+
+}// gru_seq_td (stream)
+
+}//end namespace
+
+#endif
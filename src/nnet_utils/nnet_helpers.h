@@ -27,6 +27,7 @@
 #include <algorithm>
 #include <map>
 #include "hls_stream.h"
+#include "nnet_common.h"
 
 namespace nnet {
 
@@ -399,18 +400,6 @@ void  hls_stream_debug(hls::stream<data_T> &data, hls::stream<data_T> &res)
     }
 }
 
-constexpr int ceillog2(int x){
-  return (x <= 2) ? 1 : 1 + ceillog2((x+1) / 2);
-}
-
-constexpr int floorlog2(int x){
-  return (x < 2) ? 0 : 1 + floorlog2(x / 2);
-}
-
-constexpr int pow2(int x){
-  return x == 0 ? 1 : 2 * pow2(x - 1);
-}
-
 }
 
 #endif
@@ -8,6 +8,12 @@
 #include "nnet_dense.h"
 #include <math.h>
 #include <assert.h>
+#include <type_traits>
+#ifndef __SYNTHESIS__
+#include <mutex>
+#include <condition_variable>
+#include "nnet_spsc.h"
+#endif
 
 namespace nnet {
 
@@ -27,6 +33,10 @@ struct lstm_config
     static const unsigned LSTM_DEBUG = 0;
     static const unsigned reuse_factor = 1;
     static const unsigned reuse_factor_tail = 1;
+    // timesteps sharing one cell datapath; timestep means no unroll
+    static const unsigned reuse_factor_ts = 4;
+    // largest length_h run through lstm_cell_fused in software builds
+    static const unsigned cpu_fused_max_h = 16;
     static const bool store_weights_in_bram = false;
 };
 
@@ -179,33 +189,154 @@ void lstm_fw(
 
 
 
-// LSTM layer with setting the sequence return 
-// output: hidden_size x timestep
-template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H>
-void lstm_seq(
-    data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
-    typename CONFIG_T::weight_t weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
-    typename CONFIG_T::weight_t weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
-    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
-    res_T  res[CONFIG_T::length_h*CONFIG_T::timestep]
+#ifndef __SYNTHESIS__
+// *************************************************
+//       Fused LSTM cell (software builds)
+// *************************************************
+// Row-wise adder_tree: the same additions, in the same order, that
+// dense_simple's accum_tree does per column, as M-wide vector adds.
+// Reduces in place, the sum ends up in x[0].
+template<class T, int N, int M>
+struct row_adder_tree {
+    static void sum(T x[][M]) {
+        row_adder_tree<T, N/2, M>::sum(x);
+        row_adder_tree<T, N - N/2, M>::sum(x + N/2);
+        for (int jj = 0; jj < M; jj++) x[0][jj] += x[N/2][jj];
+    }
+};
+
+template<class T, int M>
+struct row_adder_tree<T, 1, M> {
+    static void sum(T x[][M]) {}
+};
+
+// acc += data * weights, accumulated like dense_simple<CONFIG_D>
+template<class data_T, typename CONFIG_D>
+inline void lstm_fused_project(
+    const data_T data[CONFIG_D::n_in],
+    const typename CONFIG_D::weight_t weights[CONFIG_D::n_in * CONFIG_D::n_out],
+    typename CONFIG_D::accum_t acc[CONFIG_D::n_out]
+){
+    if (CONFIG_D::accum_type == accum_tree) {
+        typename CONFIG_D::accum_t rows[CONFIG_D::n_in][CONFIG_D::n_out];
+        for (int ii = 0; ii < CONFIG_D::n_in; ii++) {
+            for (int jj = 0; jj < CONFIG_D::n_out; jj++) {
+                rows[ii][jj] = (typename CONFIG_D::mult_t) (data[ii] * weights[ii*CONFIG_D::n_out+jj]);
+            }
+        }
+        row_adder_tree<typename CONFIG_D::accum_t, CONFIG_D::n_in, CONFIG_D::n_out>::sum(rows);
+        for (int jj = 0; jj < CONFIG_D::n_out; jj++) acc[jj] += rows[0][jj];
+    } else {
+        for (int ii = 0; ii < CONFIG_D::n_in; ii++) {
+            const data_T x = data[ii];
+            for (int jj = 0; jj < CONFIG_D::n_out; jj++) {
+                acc[jj] += (typename CONFIG_D::mult_t) (x * weights[ii*CONFIG_D::n_out+jj]);
+            }
+        }
+    }
+}
+
+// Encoded (compressed/exponent) weights: not handled, use lstm_step
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+bool lstm_cell_fused(
+    data_T input_x[CONFIG_T::length_x],
+    weight_x_T weights_x[],
+    weight_h_T weights_h[],
+    typename CONFIG_T::bias_t biases[CONFIG_T::length_h * 4],
+    data_T h_state[CONFIG_T::length_h],
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h],
+    std::false_type
+){
+    return false;
+}
+
+// One timestep of a small cell in a single pass over a 4*length_h
+// accumulator: both projections as row-wise multiply-adds (vectorized along
+// the gates, weights stay in registers/L1), the gate activations in place,
+// then the cell and hidden update. No GATES_SPLIT, lstm_tail or copy
+// stages; results are identical to lstm_step's.
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H>
+bool lstm_cell_fused(
+    data_T input_x[CONFIG_T::length_x],
+    typename CONFIG_X::weight_t weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    typename CONFIG_H::weight_t weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t biases[CONFIG_T::length_h * 4],
+    data_T h_state[CONFIG_T::length_h],
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h],
+    std::true_type
 ){
+    const int NH = CONFIG_T::length_h;
+    typename CONFIG_T::accum_t acc[NH * 4];
+    data_T activ[NH * 4];
+    data_T c_activ[NH];
+
+    for (int jj = 0; jj < NH * 4; jj++) acc[jj] = (typename CONFIG_T::accum_t) biases[jj];
+    lstm_fused_project<data_T, CONFIG_X>(input_x, weights_x, acc);
+    lstm_fused_project<data_T, CONFIG_H>(h_state, weights_h, acc);
+
+    // gate order i, f, g, o as in GATES_SPLIT; the shared-table and exact
+    // implementations take all four gates in one sigmoid_tanh call, as in
+    // lstm_step, with g and o swapped so the three sigmoid gates come first
+    const bool ifog = CONFIG_A::activ_impl == activ_lut_shared || CONFIG_A::activ_impl == activ_exact;
+    const int g = ifog ? 3 * NH : 2 * NH;
+    const int o = ifog ? 2 * NH : 3 * NH;
+    if (ifog) {
+        for (int ii = 0; ii < NH; ii++) std::swap(acc[2 * NH + ii], acc[3 * NH + ii]);
+        if (CONFIG_A::activ_impl == activ_exact)
+            sigmoid_tanh_exact<typename CONFIG_T::accum_t, data_T, CONFIG_A, 3 * NH, NH>(acc, activ);
+        else
+            sigmoid_tanh<typename CONFIG_T::accum_t, data_T, CONFIG_A, 3 * NH, NH>(acc, activ);
+    } else {
+        sigmoid<typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc,          activ);
+        sigmoid<typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc + NH,     activ + NH);
+        tanh   <typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc + 2 * NH, activ + 2 * NH);
+        sigmoid<typename CONFIG_T::accum_t, data_T, CONFIG_A>(acc + 3 * NH, activ + 3 * NH);
+    }
 
-    //typename CONFIG_T::mult_t mult_x[CONFIG_T::length_x * CONFIG_T::length_h * 4 ];
-    //typename CONFIG_T::mult_t mult_h[CONFIG_T::length_h * CONFIG_T::length_h * 4 ];
-    typename CONFIG_T::accum_t acc_x[CONFIG_T::length_h * 4];
-    typename CONFIG_T::accum_t acc[CONFIG_T::length_h * 4];
-    data_T acc_activ[CONFIG_T::length_h * 4];
+    for (int ii = 0; ii < NH; ii++) {
+        typename CONFIG_T::accum_t c_tmp1 = activ[NH + ii] * c_state[ii];
+        typename CONFIG_T::accum_t c_tmp2 = activ[ii] * activ[g + ii];
+        c_state[ii] = c_tmp1 + c_tmp2;
+    }
+    tanh<typename CONFIG_T::accum_t, data_T, CONFIG_A>(c_state, c_activ);
+    for (int ii = 0; ii < NH; ii++) {
+        h_state[ii] = activ[o + ii] * c_activ[ii];
+    }
+    return true;
+}
+#endif
 
-    // Parallel mode
-    //#pragma HLS PIPELINE
+// One LSTM timestep: gate projections of x_t and h_{t-1}, activations and
+// the cell/hidden update. h_state/c_state are updated in place.
+// weights_x/weights_h may be plain, compressed_weight or exponent_weight arrays, see nnet::dense
+template<class data_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void lstm_step(
+    data_T input_x[CONFIG_T::length_x],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
+    data_T h_state[CONFIG_T::length_h],
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h]
+){
     #pragma HLS INLINE
 
+#ifndef __SYNTHESIS__
+    // Small cells with plain weights take the fused software kernel
+    typedef std::integral_constant<bool,
+        std::is_same<weight_x_T, typename CONFIG_X::weight_t>::value &&
+        std::is_same<weight_h_T, typename CONFIG_H::weight_t>::value> plain_weights;
+    if (CONFIG_T::length_h <= CONFIG_T::cpu_fused_max_h &&
+        lstm_cell_fused<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(
+            input_x, weights_x, weights_h, biases, h_state, c_state, plain_weights())) {
+        return;
+    }
+#endif
+
+    typename CONFIG_T::accum_t acc_x[CONFIG_T::length_h * 4];
+    typename CONFIG_T::accum_t acc[CONFIG_T::length_h * 4];
 
-    data_T h_pre[CONFIG_T::length_h];
     data_T h_cur[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t c_pre[CONFIG_T::length_h];
     typename CONFIG_T::accum_t c_cur[CONFIG_T::length_h];
-    data_T c_cur_activ[CONFIG_T::length_h];
 
     typename CONFIG_T::accum_t gate_i[CONFIG_T::length_h];
     typename CONFIG_T::accum_t gate_f[CONFIG_T::length_h];
@@ -216,16 +347,100 @@ void lstm_seq(
     data_T gate_g_activ[CONFIG_T::length_h];
     data_T gate_o_activ[CONFIG_T::length_h];
 
+    dense<data_T, typename CONFIG_T::accum_t, CONFIG_X>(input_x, acc_x, weights_x, biases);
+    dense<data_T, typename CONFIG_T::accum_t, CONFIG_H>(h_state, acc, weights_h, acc_x);
 
+    GATES_SPLIT:
+    for(int igate = 0; igate < CONFIG_T::length_h; igate++){
+        #pragma HLS UNROLL
+        gate_i[igate] = acc[igate];
+        gate_f[igate] = acc[1*CONFIG_T::length_h+igate];
+        gate_g[igate] = acc[2*CONFIG_T::length_h+igate];
+        gate_o[igate] = acc[3*CONFIG_T::length_h+igate];
+    }
+
+    if (CONFIG_A::activ_impl == activ_lut_shared || CONFIG_A::activ_impl == activ_exact) {
+        // all four gates in one call: i, f, o on the sigmoid path, g on tanh
+        typename CONFIG_T::accum_t gate_ifog[CONFIG_T::length_h * 4];
+        data_T gate_ifog_activ[CONFIG_T::length_h * 4];
+        GATES_IFOG:
+        for(int igate = 0; igate < CONFIG_T::length_h; igate++){
+            #pragma HLS UNROLL
+            gate_ifog[igate] = gate_i[igate];
+            gate_ifog[1*CONFIG_T::length_h+igate] = gate_f[igate];
+            gate_ifog[2*CONFIG_T::length_h+igate] = gate_o[igate];
+            gate_ifog[3*CONFIG_T::length_h+igate] = gate_g[igate];
+        }
+        if (CONFIG_A::activ_impl == activ_exact)
+            sigmoid_tanh_exact<typename CONFIG_T::accum_t, data_T, CONFIG_A, 3*CONFIG_T::length_h, CONFIG_T::length_h>(gate_ifog, gate_ifog_activ);
+        else
+            sigmoid_tanh<typename CONFIG_T::accum_t, data_T, CONFIG_A, 3*CONFIG_T::length_h, CONFIG_T::length_h>(gate_ifog, gate_ifog_activ);
+        GATES_IFOG_ACTIV:
+        for(int igate = 0; igate < CONFIG_T::length_h; igate++){
+            #pragma HLS UNROLL
+            gate_i_activ[igate] = gate_ifog_activ[igate];
+            gate_f_activ[igate] = gate_ifog_activ[1*CONFIG_T::length_h+igate];
+            gate_o_activ[igate] = gate_ifog_activ[2*CONFIG_T::length_h+igate];
+            gate_g_activ[igate] = gate_ifog_activ[3*CONFIG_T::length_h+igate];
+        }
+    } else {
+        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_i, gate_i_activ);
+        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_f, gate_f_activ);
+        //hard_tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
+        tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
+        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_o, gate_o_activ);
+    }
+
+    lstm_tail<data_T, CONFIG_T, CONFIG_A> (gate_i_activ, gate_f_activ, gate_g_activ, gate_o_activ, c_state, c_cur, h_cur);
+
+    STATE:
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS UNROLL
+        h_state[ii] = h_cur[ii];
+        c_state[ii] = c_cur[ii];
+    }
+}// lstm_step
+
+
+// LSTM layer with setting the sequence return 
+// output: hidden_size x timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void lstm_seq(
+    data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
+    res_T  res[CONFIG_T::length_h*CONFIG_T::timestep]
+){
+
+    // Parallel mode
+    //#pragma HLS PIPELINE
+    #pragma HLS INLINE
+
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
     data_T input_x[CONFIG_T::length_x];
 
+    // Replicate the cell timestep/reuse_factor_ts times. Only h/c chain the
+    // copies, so the input projections of the unrolled steps run in parallel.
+    // The partition factors are 1, no partition, when nothing is replicated;
+    // they are enumerators so the pragmas see compile-time constants.
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1,
+        res_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_h : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+    #pragma HLS ARRAY_PARTITION variable=res cyclic factor=res_factor
+
     for(int ii = 0; ii < CONFIG_T::length_h; ii++){
         #pragma HLS unroll
-        h_pre[ii] = 0;
-        c_pre[ii] = 0;
+        h_state[ii] = 0;
+        c_state[ii] = 0;
     }
 
     TIMESTEP:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
         #pragma HLS PIPELINE rewind
 
 
@@ -236,32 +451,12 @@ void lstm_seq(
             input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
         }
 
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_X>(input_x, acc_x, weights_x, biases);
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_H>(h_pre, acc, weights_h, acc_x);
-
-        GATES_SPLIT:
-        for(int igate = 0; igate < CONFIG_T::length_h; igate++){
-            #pragma HLS UNROLL
-            gate_i[igate] = acc[igate];
-            gate_f[igate] = acc[1*CONFIG_T::length_h+igate];
-            gate_g[igate] = acc[2*CONFIG_T::length_h+igate];
-            gate_o[igate] = acc[3*CONFIG_T::length_h+igate];
-        }
-
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_i, gate_i_activ);
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_f, gate_f_activ);
-        //hard_tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_o, gate_o_activ);
-
-        lstm_tail<data_T, CONFIG_T, CONFIG_A> (gate_i_activ, gate_f_activ, gate_g_activ, gate_o_activ, c_pre, c_cur, h_cur);
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
 
+        OUTPUT:
         for(int ii = 0; ii < CONFIG_T::length_h; ii++){
             #pragma HLS UNROLL
-            h_pre[ii] = h_cur[ii];
-            c_pre[ii] = c_cur[ii];
-
-            res[ii+its*CONFIG_T::length_h] = (res_T) h_cur[ii];
+            res[ii+its*CONFIG_T::length_h] = (res_T) h_state[ii];
         }
 
     }
@@ -271,50 +466,40 @@ void lstm_seq(
 
 // LSTM layer without setting the sequence return 
 // output: only the final hidden units 
-template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H>
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
 void lstm(
 	//int index,
     data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
-    typename CONFIG_T::weight_t weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
-    typename CONFIG_T::weight_t weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
 	typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
 	res_T  res[CONFIG_T::length_h]
 ){
 
-    typename CONFIG_T::accum_t acc_x[CONFIG_T::length_h * 4];
-    typename CONFIG_T::accum_t acc[CONFIG_T::length_h * 4];
-    data_T acc_activ[CONFIG_T::length_h * 4];
-
     // Parallel mode
 	//#pragma HLS PIPELINE
 	#pragma HLS INLINE
 
-    data_T h_pre[CONFIG_T::length_h];
-    data_T h_cur[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t c_pre[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t c_cur[CONFIG_T::length_h];
-    data_T c_cur_activ[CONFIG_T::length_h];
-
-    typename CONFIG_T::accum_t gate_i[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_f[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_g[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_o[CONFIG_T::length_h];
-    data_T gate_i_activ[CONFIG_T::length_h];
-    data_T gate_f_activ[CONFIG_T::length_h];
-    data_T gate_g_activ[CONFIG_T::length_h];
-    data_T gate_o_activ[CONFIG_T::length_h];
-
-
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
     data_T input_x[CONFIG_T::length_x];
 
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+
     for(int ii = 0; ii < CONFIG_T::length_h; ii++){
 		#pragma HLS unroll
-        h_pre[ii] = 0;
-        c_pre[ii] = 0;
+        h_state[ii] = 0;
+        c_state[ii] = 0;
     }
 
     LSTM_TS:
 	for(int its = 0; its < CONFIG_T::timestep; its++) {
+		#pragma HLS UNROLL factor=ts_unroll
 		#pragma HLS PIPELINE rewind
 
     	INUTT_X:for(int ix = 0; ix < CONFIG_T::length_x; ix++){
@@ -323,93 +508,57 @@ void lstm(
     		input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
     	}
 
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_X>(input_x, acc_x, weights_x, biases);
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_H>(h_pre, acc, weights_h, acc_x);
-
-
-        GATES_SPLIT:for(int igate = 0; igate < CONFIG_T::length_h; igate++){
-            #pragma HLS UNROLL
-    		gate_i[igate] = acc[igate];
-    		gate_f[igate] = acc[1*CONFIG_T::length_h+igate];
-    		gate_g[igate] = acc[2*CONFIG_T::length_h+igate];
-    		gate_o[igate] = acc[3*CONFIG_T::length_h+igate];
-    	}
-
-    	//template<class data_T, class res_T, typename CONFIG_T>
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_i, gate_i_activ);
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_f, gate_f_activ);
-        //hard_tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_o, gate_o_activ);
-
-        lstm_tail<data_T, CONFIG_T, CONFIG_A> (gate_i_activ, gate_f_activ, gate_g_activ, gate_o_activ, c_pre, c_cur, h_cur);
-
-    	OUTPUT: for(int ii = 0; ii < CONFIG_T::length_h; ii++){
-            #pragma HLS UNROLL
-            h_pre[ii] = h_cur[ii];
-            c_pre[ii] = c_cur[ii];
-    	}
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
 
     }
 
     OUTPUT_FINAL: for(int ii = 0; ii < CONFIG_T::length_h; ii++) {
 		#pragma HLS unroll
-        res[ii] = (res_T) h_cur[ii];
+        res[ii] = (res_T) h_state[ii];
     }
 
 }// lstm_
 
 // LSTM + Timedistrbuted Dense
 // improve timing and help vivado hls to synthesis easily when timestep ls large
-template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, typename CONFIG_TD>
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, typename CONFIG_TD, class weight_x_T, class weight_h_T, class weight_td_T>
 void lstm_seq_td(
     data_T data[CONFIG_T::length_x*CONFIG_T::timestep],
-    typename CONFIG_T::weight_t weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
-    typename CONFIG_T::weight_t weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
     typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
 
-	typename CONFIG_TD::weight_t weights_td[CONFIG_TD::n_in * CONFIG_TD::n_out],
+	weight_td_T weights_td[CONFIG_TD::n_in * CONFIG_TD::n_out],
 	typename CONFIG_TD::bias_t   biases_td [CONFIG_TD::n_out],
     res_T  res[CONFIG_TD::n_out*CONFIG_T::timestep]
 ){
 
-    //typename CONFIG_T::mult_t mult_x[CONFIG_T::length_x * CONFIG_T::length_h * 4 ];
-    //typename CONFIG_T::mult_t mult_h[CONFIG_T::length_h * CONFIG_T::length_h * 4 ];
-    typename CONFIG_T::accum_t acc_x[CONFIG_T::length_h * 4];
-    typename CONFIG_T::accum_t acc[CONFIG_T::length_h * 4];
-    data_T acc_activ[CONFIG_T::length_h * 4];
-
     // Parallel mode
     //#pragma HLS PIPELINE
     #pragma HLS INLINE
 
-
-    data_T h_pre[CONFIG_T::length_h];
-    data_T h_cur[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t c_pre[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t c_cur[CONFIG_T::length_h];
-    data_T c_cur_activ[CONFIG_T::length_h];
-
-    typename CONFIG_T::accum_t gate_i[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_f[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_g[CONFIG_T::length_h];
-    typename CONFIG_T::accum_t gate_o[CONFIG_T::length_h];
-    data_T gate_i_activ[CONFIG_T::length_h];
-    data_T gate_f_activ[CONFIG_T::length_h];
-    data_T gate_g_activ[CONFIG_T::length_h];
-    data_T gate_o_activ[CONFIG_T::length_h];
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
     res_T tdense_out[CONFIG_TD::n_out];
-
-
     data_T input_x[CONFIG_T::length_x];
 
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq
+    enum {
+        ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts),
+        data_factor = ts_unroll > 1 ? ts_unroll * CONFIG_T::length_x : 1,
+        res_factor = ts_unroll > 1 ? ts_unroll * CONFIG_TD::n_out : 1
+    };
+    #pragma HLS ARRAY_PARTITION variable=data cyclic factor=data_factor
+    #pragma HLS ARRAY_PARTITION variable=res cyclic factor=res_factor
+
     for(int ii = 0; ii < CONFIG_T::length_h; ii++){
         #pragma HLS unroll
-        h_pre[ii] = 0;
-        c_pre[ii] = 0;
+        h_state[ii] = 0;
+        c_state[ii] = 0;
     }
 
     TIMESTEP_TD:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
         #pragma HLS PIPELINE rewind
 
 
@@ -420,46 +569,585 @@ void lstm_seq_td(
             input_x[ix] = data[ix+its*CONFIG_T::length_x] ;
         }
 
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_X>(input_x, acc_x, weights_x, biases);
-        dense_simple<data_T, typename CONFIG_T::accum_t, CONFIG_H>(h_pre, acc, weights_h, acc_x);
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
 
-        GATES_SPLIT:
-        for(int igate = 0; igate < CONFIG_T::length_h; igate++){
-            #pragma HLS UNROLL
-            gate_i[igate] = acc[igate];
-            gate_f[igate] = acc[1*CONFIG_T::length_h+igate];
-            gate_g[igate] = acc[2*CONFIG_T::length_h+igate];
-            gate_o[igate] = acc[3*CONFIG_T::length_h+igate];
+        nnet::dense<data_T, res_T, CONFIG_TD>(h_state, tdense_out, weights_td, biases_td);
+
+        OUTPUT_FINAL: for(int ii = 0; ii < CONFIG_TD::n_out; ii++) {
+    		#pragma HLS unroll
+            res[ii+its*CONFIG_TD::n_out] = (res_T) tdense_out[ii];
         }
 
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_i, gate_i_activ);
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_f, gate_f_activ);
-        //hard_tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        tanh <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_g, gate_g_activ); // tanh
-        sigmoid   <typename CONFIG_T::accum_t, data_T, CONFIG_A> ( gate_o, gate_o_activ);
+    }
 
-        lstm_tail<data_T, CONFIG_T, CONFIG_A> (gate_i_activ, gate_f_activ, gate_g_activ, gate_o_activ, c_pre, c_cur, h_cur);
+}// lstm_seq_td
+
+
+// *************************************************
+//       Streaming (io_serial) LSTM layers
+// *************************************************
+// The streams carry one element per beat, length_x beats per timestep in and
+// length_h (or n_out) beats per timestep out. Only the cell state is kept
+// in registers, so layers can be chained through FIFOs under DATAFLOW.
+
+// LSTM layer with the sequence return, length_h elements per timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void lstm_seq(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=c_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq; the
+    // copies take their input beats one after the other
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+        c_state[ii] = 0;
+    }
 
+    TIMESTEP_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
+        }
+
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
+
+        OUTPUT:
         for(int ii = 0; ii < CONFIG_T::length_h; ii++){
-            #pragma HLS UNROLL
-            h_pre[ii] = h_cur[ii];
-            c_pre[ii] = c_cur[ii];
+            #pragma HLS PIPELINE
+            res.write((res_T) h_state[ii]);
+        }
+    }
+
+}// lstm_seq (stream)
 
-            //res[ii+its*CONFIG_T::length_h] = (res_T) h_cur[ii];
+
+// LSTM layer without the sequence return, length_h elements after the last timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, class weight_x_T, class weight_h_T>
+void lstm(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=c_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq (stream)
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+        c_state[ii] = 0;
+    }
+
+    LSTM_TS_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
         }
-        nnet::dense_simple<data_T, res_T, CONFIG_TD>(h_cur, tdense_out, weights_td, biases_td);
 
-        OUTPUT_FINAL: for(int ii = 0; ii < CONFIG_TD::n_out; ii++) {
-    		#pragma HLS unroll
-            res[ii+its*CONFIG_TD::n_out] = (res_T) tdense_out[ii];
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
+    }
+
+    OUTPUT_FINAL:
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS PIPELINE
+        res.write((res_T) h_state[ii]);
+    }
+
+}// lstm (stream)
+
+
+// LSTM + TimeDistributed Dense, n_out elements per timestep
+template<class data_T, class res_T, typename CONFIG_T, typename CONFIG_A, typename CONFIG_X, typename CONFIG_H, typename CONFIG_TD, class weight_x_T, class weight_h_T, class weight_td_T>
+void lstm_seq_td(
+    hls::stream<data_T> &data,
+    weight_x_T weights_x[CONFIG_T::length_x * CONFIG_T::length_h * 4],
+    weight_h_T weights_h[CONFIG_T::length_h * CONFIG_T::length_h * 4],
+    typename CONFIG_T::bias_t   biases[CONFIG_T::length_h * 4],
+
+    weight_td_T weights_td[CONFIG_TD::n_in * CONFIG_TD::n_out],
+    typename CONFIG_TD::bias_t   biases_td [CONFIG_TD::n_out],
+    hls::stream<res_T> &res
+){
+
+    data_T h_state[CONFIG_T::length_h];
+    typename CONFIG_T::accum_t c_state[CONFIG_T::length_h];
+    data_T input_x[CONFIG_T::length_x];
+    res_T tdense_out[CONFIG_TD::n_out];
+    #pragma HLS ARRAY_PARTITION variable=h_state complete
+    #pragma HLS ARRAY_PARTITION variable=c_state complete
+    #pragma HLS ARRAY_PARTITION variable=input_x complete
+
+    // Replicate the cell timestep/reuse_factor_ts times, see lstm_seq (stream)
+    enum { ts_unroll = DIV_ROUNDUP(CONFIG_T::timestep, CONFIG_T::reuse_factor_ts) };
+
+    for(int ii = 0; ii < CONFIG_T::length_h; ii++){
+        #pragma HLS unroll
+        h_state[ii] = 0;
+        c_state[ii] = 0;
+    }
+
+    TIMESTEP_TD_S:for(int its = 0; its < CONFIG_T::timestep; its++) {
+        #pragma HLS UNROLL factor=ts_unroll
+        INPUT_X:
+        for(int ix = 0; ix < CONFIG_T::length_x; ix++){
+            #pragma HLS PIPELINE
+            input_x[ix] = data.read();
         }
-        //res[ii+its*CONFIG_T::length_h] = (res_T) h_cur[ii];
 
+        lstm_step<data_T, CONFIG_T, CONFIG_A, CONFIG_X, CONFIG_H>(input_x, weights_x, weights_h, biases, h_state, c_state);
+
+        nnet::dense<data_T, res_T, CONFIG_TD>(h_state, tdense_out, weights_td, biases_td);
+
+        OUTPUT:
+        for(int ii = 0; ii < CONFIG_TD::n_out; ii++){
+            #pragma HLS PIPELINE
+            res.write(tdense_out[ii]);
+        }
     }
 
-}// lstm_seq_td
+}// lstm_seq_td (stream)
+
+
+// *************************************************
+//       Stacked LSTM (nn.LSTM with num_layers > 1)
+// *************************************************
+// A stack of streaming LSTM layers, layer l feeding layer l+1. The stack
+// config provides a member template layer<L> with the lstm_seq configs of
+// layer L (config, activ_config, config_x, config_h); the weights of all
+// layers are packed back to back in three arrays, see lstm_stack_offset.
+// Each layer is its own DATAFLOW process connected by a FIFO of two
+// timesteps, so layer l works on timestep t while layer l+1 works on t-1:
+// a wavefront through the stack, one extra cell latency per layer instead
+// of one extra sequence. The array overload runs the same stream stack
+// between an array-to-stream and a stream-to-array adapter.
+struct lstm_stack_config
+{
+    typedef float bias_t;
+    typedef float weight_t;
+
+    // false: the last layer writes only its final hidden state (as nnet::lstm)
+    static const bool return_sequences = true;
+
+    // Software builds: run the layers on their own threads, see
+    // lstm_stack_wavefront. With cpu_pin, layer L is pinned to core
+    // cpu_first_core + L; cpu_first_core < 0 takes the next N_LAYERS cores
+    // no other stack has taken. Layers that would not fit on the machine's
+    // cores are left unpinned.
+    static const bool cpu_wavefront = true;
+    static const bool cpu_pin = true;
+    static const int cpu_first_core = -1;
+
+    // template<int L> struct layer {
+    //     typedef ... config; typedef ... activ_config;
+    //     typedef ... config_x; typedef ... config_h;
+    // };
+};
+
+// Position of layer L in the packed weights, and for L = N_LAYERS their sizes
+template<typename STACK_T, int L>
+struct lstm_stack_offset
+{
+    typedef typename STACK_T::template layer<L-1>::config prev_t;
+    static const unsigned wx = lstm_stack_offset<STACK_T, L-1>::wx + prev_t::length_x * prev_t::length_h * 4;
+    static const unsigned wh = lstm_stack_offset<STACK_T, L-1>::wh + prev_t::length_h * prev_t::length_h * 4;
+    static const unsigned b  = lstm_stack_offset<STACK_T, L-1>::b  + prev_t::length_h * 4;
+};
+
+template<typename STACK_T>
+struct lstm_stack_offset<STACK_T, 0>
+{
+    static const unsigned wx = 0;
+    static const unsigned wh = 0;
+    static const unsigned b  = 0;
+};
+
+// Layer L and the rest of the stack after it
+template<class data_T, class res_T, typename STACK_T, int L, int N_LAYERS, bool LAST = (L + 1 == N_LAYERS)>
+struct lstm_stack_layer
+{
+    typedef typename STACK_T::template layer<L> layer_t;
+    typedef lstm_stack_offset<STACK_T, L> offset_t;
+    typedef lstm_stack_offset<STACK_T, N_LAYERS> total_t;
+
+    static void run(
+        hls::stream<data_T> &data,
+        typename STACK_T::weight_t weights_x[total_t::wx],
+        typename STACK_T::weight_t weights_h[total_t::wh],
+        typename STACK_T::bias_t   biases[total_t::b],
+        hls::stream<res_T> &res
+    ){
+        #pragma HLS INLINE
+
+        hls::stream<data_T> layer_out("lstm_stack_out");
+        enum { fifo_depth = 2 * layer_t::config::length_h };
+        #pragma HLS STREAM variable=layer_out depth=fifo_depth
+
+        lstm_seq<data_T, data_T, typename layer_t::config, typename layer_t::activ_config, typename layer_t::config_x, typename layer_t::config_h>(
+            data, &weights_x[offset_t::wx], &weights_h[offset_t::wh], &biases[offset_t::b], layer_out);
+
+        lstm_stack_layer<data_T, res_T, STACK_T, L + 1, N_LAYERS>::run(layer_out, weights_x, weights_h, biases, res);
+    }
+};
+
+template<class data_T, class res_T, typename STACK_T, int L, int N_LAYERS>
+struct lstm_stack_layer<data_T, res_T, STACK_T, L, N_LAYERS, true>
+{
+    typedef typename STACK_T::template layer<L> layer_t;
+    typedef lstm_stack_offset<STACK_T, L> offset_t;
+    typedef lstm_stack_offset<STACK_T, N_LAYERS> total_t;
+
+    static void run(
+        hls::stream<data_T> &data,
+        typename STACK_T::weight_t weights_x[total_t::wx],
+        typename STACK_T::weight_t weights_h[total_t::wh],
+        typename STACK_T::bias_t   biases[total_t::b],
+        hls::stream<res_T> &res
+    ){
+        #pragma HLS INLINE
+
+        if (STACK_T::return_sequences) {
+            lstm_seq<data_T, res_T, typename layer_t::config, typename layer_t::activ_config, typename layer_t::config_x, typename layer_t::config_h>(
+                data, &weights_x[offset_t::wx], &weights_h[offset_t::wh], &biases[offset_t::b], res);
+        } else {
+            lstm<data_T, res_T, typename layer_t::config, typename layer_t::activ_config, typename layer_t::config_x, typename layer_t::config_h>(
+                data, &weights_x[offset_t::wx], &weights_h[offset_t::wh], &biases[offset_t::b], res);
+        }
+    }
+};
+
+// The adapters around the stream stack in the array lstm_stack
+template<class T, int N>
+void lstm_stack_read_array(T data[N], hls::stream<T> &res)
+{
+    for(int ii = 0; ii < N; ii++){
+        #pragma HLS PIPELINE
+        res.write(data[ii]);
+    }
+}
+
+template<class T, int N>
+void lstm_stack_write_array(hls::stream<T> &data, T res[N])
+{
+    for(int ii = 0; ii < N; ii++){
+        #pragma HLS PIPELINE
+        res[ii] = data.read();
+    }
+}
+
+#ifndef __SYNTHESIS__
+// Largest length_h of the first L layers
+template<typename STACK_T, int L>
+struct lstm_stack_max_h
+{
+    static const unsigned h = STACK_T::template layer<L-1>::config::length_h;
+    static const unsigned prev = lstm_stack_max_h<STACK_T, L-1>::value;
+    static const unsigned value = h > prev ? h : prev;
+};
+
+template<typename STACK_T>
+struct lstm_stack_max_h<STACK_T, 0>
+{
+    static const unsigned value = 0;
+};
+
+// Next core handed to a wavefront with cpu_first_core < 0, process-wide
+inline std::atomic<int> &wavefront_next_core() {
+    static std::atomic<int> next(0);
+    return next;
+}
+
+// Software counterpart of lstm_stack's wavefront: one thread per layer,
+// the input rows and the hidden vector of each timestep handed on through
+// spsc_queues, so layer l+1 runs timestep t-1 while layer l runs t. The
+// calling thread only feeds the first layer and collects the last. The
+// workers live as long as the object and park between runs. run() is not
+// reentrant: callers share an object by holding busy() around it.
+template<class data_T, class res_T, int N_LAYERS, typename STACK_T>
+class lstm_stack_wavefront
+{
+    static_assert(N_LAYERS > 1, "lstm_stack_wavefront needs at least two layers");
+
+public:
+    typedef lstm_stack_offset<STACK_T, N_LAYERS> total_t;
+    typedef typename STACK_T::template layer<0>::config first_t;
+    typedef typename STACK_T::template layer<N_LAYERS-1>::config last_t;
+    static const unsigned timestep = first_t::timestep;
+
+    lstm_stack_wavefront() : stop_(false), generation_(0) {
+        first_core_ = pick_first_core();
+        start(std::integral_constant<int, 0>());
+    }
+
+    ~lstm_stack_wavefront() {
+        {
+            std::lock_guard<std::mutex> lock(park_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (int ii = 0; ii < N_LAYERS; ii++) workers_[ii].join();
+    }
+
+    std::mutex &busy() { return busy_; }
+
+    // res: timestep x last length_h, or the final hidden state only when
+    // STACK_T::return_sequences is false
+    void run(
+        data_T data[first_t::length_x * timestep],
+        typename STACK_T::weight_t weights_x[total_t::wx],
+        typename STACK_T::weight_t weights_h[total_t::wh],
+        typename STACK_T::bias_t   biases[total_t::b],
+        res_T *res
+    ){
+        // Published to the workers with the new generation
+        weights_x_ = weights_x;
+        weights_h_ = weights_h;
+        biases_ = biases;
+        {
+            std::lock_guard<std::mutex> lock(park_);
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+        wake_.notify_all();
+
+        hidden_t row;
+        for (int its = 0; its < timestep; its++) {
+            for (int ix = 0; ix < first_t::length_x; ix++) row.h[ix] = data[its * first_t::length_x + ix];
+            queues_[0].push(row);
+        }
+
+        for (int its = 0; its < timestep; its++) {
+            queues_[N_LAYERS].pop(row);
+            if (STACK_T::return_sequences) {
+                for (int ii = 0; ii < last_t::length_h; ii++) res[its * last_t::length_h + ii] = (res_T) row.h[ii];
+            } else if (its == timestep - 1) {
+                for (int ii = 0; ii < last_t::length_h; ii++) res[ii] = (res_T) row.h[ii];
+            }
+        }
+    }
+
+private:
+    static const unsigned max_h = lstm_stack_max_h<STACK_T, N_LAYERS>::value;
+    struct hidden_t { data_T h[max_h > first_t::length_x ? max_h : first_t::length_x]; };
+    typedef spsc_queue<hidden_t, spsc_size(timestep)> queue_t;
+
+    // Polls for the next run before parking: back-to-back windows find
+    // their workers awake, an idle stack costs no CPU
+    static const unsigned park_spins = 4096;
+
+    static int pick_first_core() {
+        if (!STACK_T::cpu_pin) return -1;
+        int first = STACK_T::cpu_first_core;
+        if (first < 0) first = wavefront_next_core().fetch_add(N_LAYERS);
+        return first + N_LAYERS <= (int) std::thread::hardware_concurrency() ? first : -1;
+    }
+
+    template<int L>
+    void step(data_T *input_x, data_T *h_state, typename STACK_T::template layer<L>::config::accum_t *c_state) {
+        typedef typename STACK_T::template layer<L> layer_t;
+        typedef lstm_stack_offset<STACK_T, L> offset_t;
+        lstm_step<data_T, typename layer_t::config, typename layer_t::activ_config, typename layer_t::config_x, typename layer_t::config_h>(
+            input_x, &weights_x_[offset_t::wx], &weights_h_[offset_t::wh], &biases_[offset_t::b], h_state, c_state);
+    }
+
+    // Wait for the run after generation seen; false once the object stops
+    bool wait_run(unsigned &seen) {
+        for (unsigned n = 0; n < park_spins; n++) {
+            if (generation_.load(std::memory_order_acquire) != seen) {
+                seen = generation_.load(std::memory_order_acquire);
+                return true;
+            }
+            queue_t::spin_wait(n);
+        }
+        std::unique_lock<std::mutex> lock(park_);
+        wake_.wait(lock, [&] { return stop_ || generation_.load(std::memory_order_relaxed) != seen; });
+        seen = generation_.load(std::memory_order_relaxed);
+        return !stop_;
+    }
+
+    // Layer L: one sequence per run, until the object is destroyed
+    template<int L>
+    void layer_loop() {
+        typedef typename STACK_T::template layer<L>::config config_t;
+        data_T h_state[config_t::length_h];
+        typename config_t::accum_t c_state[config_t::length_h];
+        hidden_t in, out;
+        unsigned seen = 0;
+
+        while (wait_run(seen)) {
+            for (int ii = 0; ii < config_t::length_h; ii++) {
+                h_state[ii] = 0;
+                c_state[ii] = 0;
+            }
+            for (int its = 0; its < timestep; its++) {
+                queues_[L].pop(in);
+                step<L>(in.h, h_state, c_state);
+                for (int ii = 0; ii < config_t::length_h; ii++) out.h[ii] = h_state[ii];
+                queues_[L+1].push(out);
+            }
+        }
+    }
+
+    template<int L>
+    void start(std::integral_constant<int, L>) {
+        workers_[L] = std::thread(&lstm_stack_wavefront::layer_loop<L>, this);
+        if (first_core_ >= 0) pin_thread(workers_[L], first_core_ + L);
+        start(std::integral_constant<int, L+1>());
+    }
+    void start(std::integral_constant<int, N_LAYERS>) {}
+
+    // queues_[0] carries the input rows, queues_[L+1] the output of layer
+    // L; every run() pushes and pops timestep entries per queue, so they
+    // never fill up
+    queue_t queues_[N_LAYERS + 1];
+    std::thread workers_[N_LAYERS];
+    int first_core_;
+    std::mutex park_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::atomic<unsigned> generation_;
+    std::mutex busy_;
+    typename STACK_T::weight_t *weights_x_;
+    typename STACK_T::weight_t *weights_h_;
+    typename STACK_T::bias_t   *biases_;
+};
+
+// lstm_stack through the lstm_stack_wavefront of its instantiation, one
+// per process whatever the number of calling threads. A caller that finds
+// it busy returns false and runs the layers itself, so concurrent callers
+// (the batch runners' threads) neither wait nor start more workers.
+template<class data_T, class res_T, int N_LAYERS, typename STACK_T>
+bool lstm_stack_cpu(
+    std::false_type,
+    data_T *data,
+    typename STACK_T::weight_t weights_x[lstm_stack_offset<STACK_T, N_LAYERS>::wx],
+    typename STACK_T::weight_t weights_h[lstm_stack_offset<STACK_T, N_LAYERS>::wh],
+    typename STACK_T::bias_t   biases[lstm_stack_offset<STACK_T, N_LAYERS>::b],
+    res_T *res
+){
+    return false;
+}
+
+template<class data_T, class res_T, int N_LAYERS, typename STACK_T>
+bool lstm_stack_cpu(
+    std::true_type,
+    data_T *data,
+    typename STACK_T::weight_t weights_x[lstm_stack_offset<STACK_T, N_LAYERS>::wx],
+    typename STACK_T::weight_t weights_h[lstm_stack_offset<STACK_T, N_LAYERS>::wh],
+    typename STACK_T::bias_t   biases[lstm_stack_offset<STACK_T, N_LAYERS>::b],
+    res_T *res
+){
+    // A core per layer and one for the caller, otherwise the threads would
+    // only take turns
+    static const bool enough_cores = std::thread::hardware_concurrency() >= N_LAYERS + 1;
+    if (!enough_cores) return false;
+
+    typedef lstm_stack_wavefront<data_T, res_T, N_LAYERS, STACK_T> exec_t;
+    static exec_t exec;
+    std::unique_lock<std::mutex> lock(exec.busy(), std::try_to_lock);
+    if (!lock.owns_lock()) return false;
+    exec.run(data, weights_x, weights_h, biases, res);
+    return true;
+}
+#endif
+
+
+// N_LAYERS stacked LSTM layers on arrays, in and out like lstm_seq (or lstm
+// when STACK_T::return_sequences is false). The array is streamed through
+// the layers of the stream overload in one DATAFLOW region, so they overlap
+// per timestep here as well.
+template<class data_T, class res_T, int N_LAYERS, typename STACK_T>
+void lstm_stack(
+    data_T data[STACK_T::template layer<0>::config::length_x * STACK_T::template layer<0>::config::timestep],
+    typename STACK_T::weight_t weights_x[lstm_stack_offset<STACK_T, N_LAYERS>::wx],
+    typename STACK_T::weight_t weights_h[lstm_stack_offset<STACK_T, N_LAYERS>::wh],
+    typename STACK_T::bias_t   biases[lstm_stack_offset<STACK_T, N_LAYERS>::b],
+    res_T *res
+){
+    #pragma HLS DATAFLOW
+
+    typedef typename STACK_T::template layer<0>::config first_t;
+    typedef typename STACK_T::template layer<N_LAYERS-1>::config last_t;
+    enum {
+        n_in = first_t::length_x * first_t::timestep,
+        n_out = last_t::length_h * (STACK_T::return_sequences ? last_t::timestep : 1),
+        in_depth = first_t::length_x,
+        out_depth = last_t::length_h
+    };
+
+#ifndef __SYNTHESIS__
+    typedef std::integral_constant<bool, (N_LAYERS > 1) && STACK_T::cpu_wavefront> wavefront;
+    if (lstm_stack_cpu<data_T, res_T, N_LAYERS, STACK_T>(wavefront(), data, weights_x, weights_h, biases, res)) return;
+#endif
+
+    hls::stream<data_T> data_s("lstm_stack_in");
+    hls::stream<res_T> res_s("lstm_stack_res");
+    #pragma HLS STREAM variable=data_s depth=in_depth
+    #pragma HLS STREAM variable=res_s depth=out_depth
+
+    lstm_stack_read_array<data_T, n_in>(data, data_s);
+    lstm_stack_layer<data_T, res_T, STACK_T, 0, N_LAYERS>::run(data_s, weights_x, weights_h, biases, res_s);
+    lstm_stack_write_array<res_T, n_out>(res_s, res);
+
+}// lstm_stack
+
+// N_LAYERS stacked LSTM layers, streaming in and out like lstm_seq (or lstm
+// when STACK_T::return_sequences is false)
+template<class data_T, class res_T, int N_LAYERS, typename STACK_T>
+void lstm_stack(
+    hls::stream<data_T> &data,
+    typename STACK_T::weight_t weights_x[lstm_stack_offset<STACK_T, N_LAYERS>::wx],
+    typename STACK_T::weight_t weights_h[lstm_stack_offset<STACK_T, N_LAYERS>::wh],
+    typename STACK_T::bias_t   biases[lstm_stack_offset<STACK_T, N_LAYERS>::b],
+    hls::stream<res_T> &res
+){
+    #pragma HLS DATAFLOW
+
+#ifndef __SYNTHESIS__
+    // Software builds: the whole sequence through the array form, which
+    // runs the layers as a threaded wavefront
+    if ((N_LAYERS > 1) && STACK_T::cpu_wavefront) {
+        typedef typename STACK_T::template layer<0>::config first_t;
+        typedef typename STACK_T::template layer<N_LAYERS-1>::config last_t;
+        const unsigned n_in = first_t::length_x * first_t::timestep;
+        const unsigned n_out = last_t::length_h * (STACK_T::return_sequences ? last_t::timestep : 1);
+        data_T in[n_in];
+        res_T out[n_out];
+        for (unsigned ii = 0; ii < n_in; ii++) in[ii] = data.read();
+        lstm_stack<data_T, res_T, N_LAYERS, STACK_T>(in, weights_x, weights_h, biases, out);
+        for (unsigned ii = 0; ii < n_out; ii++) res.write(out[ii]);
+        return;
+    }
+#endif
 
+    lstm_stack_layer<data_T, res_T, STACK_T, 0, N_LAYERS>::run(data, weights_x, weights_h, biases, res);
 
+}// lstm_stack
 
 
 
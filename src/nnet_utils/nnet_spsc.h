@@ -0,0 +1,98 @@
+#ifndef NNET_SPSC_H_
+#define NNET_SPSC_H_
+
+// Software-only helpers to run pipeline stages on their own threads (the
+// CPU counterpart of DATAFLOW processes and hls::stream FIFOs).
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace nnet {
+
+const size_t cache_line = 64;
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. N must be a power of two. head is written only by the consumer,
+// tail only by the producer; each side caches the other's index and
+// re-reads it only when the queue looks full/empty.
+template<class T, unsigned N>
+class spsc_queue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "spsc_queue size must be a power of two");
+
+public:
+    spsc_queue() : head_(0), tail_(0), head_cache_(0), tail_cache_(0) {}
+
+    bool try_push(const T &v) {
+        const size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_cache_ == N) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (t - head_cache_ == N) return false;
+        }
+        buf_[t & (N - 1)] = v;
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &v) {
+        const size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (h == tail_cache_) return false;
+        }
+        v = buf_[h & (N - 1)];
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Blocking versions, spinning with spin_wait
+    void push(const T &v) { for (unsigned n = 0; !try_push(v); n++) spin_wait(n); }
+    void pop(T &v)        { for (unsigned n = 0; !try_pop(v); n++) spin_wait(n); }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    // Backoff for polling loops: busy-spin first (a stage handing over one
+    // timestep takes well under a microsecond), then yield the core, and
+    // sleep once the other side has been idle for a while
+    static void spin_wait(unsigned n) {
+        if (n >= 65536) std::this_thread::sleep_for(std::chrono::microseconds(50));
+        else if (n >= 1024) std::this_thread::yield();
+    }
+
+private:
+    alignas(cache_line) std::atomic<size_t> head_;
+    alignas(cache_line) std::atomic<size_t> tail_;
+    alignas(cache_line) size_t head_cache_;   // producer side
+    alignas(cache_line) size_t tail_cache_;   // consumer side
+    alignas(cache_line) T buf_[N];
+};
+
+// Smallest power of two >= n, for spsc_queue sizes
+constexpr unsigned spsc_size(unsigned n, unsigned p = 1) {
+    return p >= n ? p : spsc_size(n, p * 2);
+}
+
+// Pin a thread to one core; cpu < 0 leaves it to the scheduler.
+// Returns false if the affinity could not be set.
+inline bool pin_thread(std::thread &t, int cpu) {
+    if (cpu < 0) return true;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    return pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+}//end namespace
+
+#endif